@@ -20,11 +20,56 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Tickless idle ("-tickless" option).  While the idle thread
+   halts, the 8254 runs in one-shot mode (mode 0) set to expire on
+   the first tick that has work to do; the ticks it skips over are
+   caught up on wake. */
+bool timer_tickless;
+
+/* 8254 counts per timer tick, and the most ticks that fit in
+   the 8254's 16-bit counter. */
+static uint16_t tick_count;
+static int64_t max_oneshot_ticks;
+
+/* Armed one-shot: the tick boundary it expires on, as a count of
+   boundaries from arming (0 if none is armed), the 8254 counts to
+   the first boundary, and the count it was started with. */
+static int64_t oneshot_ticks;
+static unsigned oneshot_first;
+static unsigned oneshot_count;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Hierarchical timer wheel.  Level L has ALARM_SLOTS slots that
+   each span ALARM_SLOTS**L ticks.  An armed alarm that expires
+   less than ALARM_SLOTS**(L+1) ticks from now sits in the level-L
+   slot spanning its expiry tick; one further out than the top
+   level reaches sits in the top level's furthest slot.
+
+   Each timer interrupt fires the whole level-0 slot for the
+   current tick, all of whose alarms are due.  When a higher-level
+   slot's span begins, its alarms are moved down to the level
+   their expiry is now within ("cascaded").  An alarm moves down
+   a bounded number of times, so arming and cancelling are O(1)
+   and expiry costs amortized O(1) per alarm, however far out the
+   alarms are.  Bit I of alarm_bitmap[L] is set exactly when
+   alarm_wheel[L][I] is nonempty. */
+#define ALARM_BITS 6
+#define ALARM_SLOTS (1 << ALARM_BITS)
+#define ALARM_LEVELS 4
+static struct list alarm_wheel[ALARM_LEVELS][ALARM_SLOTS];
+static uint64_t alarm_bitmap[ALARM_LEVELS];
+
 static intr_handler_func timer_interrupt;
+static void alarm_place (struct alarm *);
+static void alarm_cascade (int level, size_t slot);
+static void alarm_expire (void);
+static int64_t alarm_next_tick (void);
+static void pit_set_periodic (void);
+static void pit_set_oneshot (unsigned count);
+static void timer_catch_up (int64_t skipped);
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
@@ -36,11 +81,13 @@ void
 timer_init (void) {
 	/* 8254 input frequency divided by TIMER_FREQ, rounded to
 	   nearest. */
-	uint16_t count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	tick_count = (1193180 + TIMER_FREQ / 2) / TIMER_FREQ;
+	max_oneshot_ticks = UINT16_MAX / tick_count;
+	pit_set_periodic ();
 
-	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
-	outb (0x40, count & 0xff);
-	outb (0x40, count >> 8);
+	for (int level = 0; level < ALARM_LEVELS; level++)
+		for (int i = 0; i < ALARM_SLOTS; i++)
+			list_init (&alarm_wheel[level][i]);
 
 	intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -122,9 +169,294 @@ timer_print_stats (void) {
 	printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  In tickless mode, stops the periodic tick and arms a
+   one-shot for the next tick that has an alarm due or scheduler
+   work to do, at most max_oneshot_ticks away. */
+void
+timer_idle_enter (void) {
+	int64_t next, skip;
+	unsigned remaining;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!timer_tickless || oneshot_ticks != 0)
+		return;
+
+	next = alarm_next_tick ();
+	if (thread_mlfqs) {
+		/* Priority passes and load_avg updates must run on their
+		   own ticks.  A pass with nothing to do may be skipped. */
+		int64_t period = mlfqs_pass_pending () ? 4 : TIMER_FREQ;
+		int64_t boundary = (ticks / period + 1) * period;
+
+		if (boundary < next)
+			next = boundary;
+	}
+
+	skip = next - ticks;
+	if (skip > max_oneshot_ticks)
+		skip = max_oneshot_ticks;
+	if (skip < 2)
+		return;
+
+	/* Keep the phase of the periodic tick: the one-shot expires
+	   exactly when the SKIP'th periodic interrupt would have. */
+	outb (0x43, 0x00);    /* CW: counter 0, latch count. */
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+	if (remaining == 0 || remaining > tick_count)
+		return;
+
+	oneshot_ticks = skip;
+	oneshot_first = remaining;
+	oneshot_count = (skip - 1) * tick_count + remaining;
+	pit_set_oneshot (oneshot_count);
+}
+
+/* Called with interrupts off when the idle thread gives up the
+   CPU.  If a one-shot armed by timer_idle_enter() is still
+   counting, catches up the ticks that have passed and arms a
+   one-shot for the next tick boundary, whose interrupt restores
+   the periodic tick. */
+void
+timer_idle_exit (void) {
+	unsigned status, remaining, elapsed;
+	int64_t passed;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (oneshot_ticks == 0)
+		return;
+
+	outb (0x43, 0xc2);    /* Read-back: status and count, counter 0. */
+	status = inb (0x40);
+	remaining = inb (0x40);
+	remaining |= inb (0x40) << 8;
+	if (status & 0x80) {
+		/* Output is high: the one-shot expired and its interrupt
+		   is pending. */
+		return;
+	}
+
+	elapsed = oneshot_count - remaining;
+	passed = elapsed < oneshot_first
+		? 0 : 1 + (elapsed - oneshot_first) / tick_count;
+	timer_catch_up (passed);
+
+	oneshot_ticks = 1;
+	oneshot_first = oneshot_first + passed * tick_count - elapsed;
+	oneshot_count = oneshot_first;
+	pit_set_oneshot (oneshot_count);
+}
+
+/* Initializes alarm A to call FUNC, passing A, when it fires.
+   AUX is stored in A for FUNC's use. */
+void
+alarm_init (struct alarm *a, alarm_func *func, void *aux) {
+	ASSERT (a != NULL);
+	ASSERT (func != NULL);
+
+	a->expires = 0;
+	a->func = func;
+	a->aux = aux;
+	a->armed = false;
+}
+
+/* Arms alarm A to fire at timer tick EXPIRES, cancelling any
+   earlier arming.  An alarm whose tick has already arrived fires
+   on the next timer interrupt.  A's function runs in the timer
+   interrupt handler, so it must not sleep.
+
+   This function may be called from an interrupt handler. */
+void
+alarm_arm (struct alarm *a, int64_t expires) {
+	enum intr_level old_level;
+
+	ASSERT (a != NULL);
+
+	old_level = intr_disable ();
+	alarm_cancel (a);
+	if (expires <= ticks)
+		expires = ticks + 1;
+	a->expires = expires;
+	a->armed = true;
+	alarm_place (a);
+	intr_set_level (old_level);
+}
+
+/* Disarms alarm A.  Returns true if A was armed, false if it had
+   already fired or was never armed.
+
+   This function may be called from an interrupt handler. */
+bool
+alarm_cancel (struct alarm *a) {
+	enum intr_level old_level;
+	bool was_armed;
+
+	ASSERT (a != NULL);
+
+	old_level = intr_disable ();
+	was_armed = a->armed;
+	if (was_armed) {
+		list_remove (&a->elem);
+		if (list_empty (&alarm_wheel[a->level][a->slot]))
+			alarm_bitmap[a->level] &= ~(1ULL << a->slot);
+		a->armed = false;
+	}
+	intr_set_level (old_level);
+
+	return was_armed;
+}
+
+/* Puts armed alarm A in the wheel level and slot for its expiry
+   tick, as seen from the current tick, which must not be past
+   it. */
+static void
+alarm_place (struct alarm *a) {
+	const int64_t reach = (int64_t) 1 << (ALARM_BITS * ALARM_LEVELS);
+	int64_t delta = a->expires - ticks;
+	int64_t at = delta < reach ? a->expires : ticks + reach - 1;
+	int level;
+
+	ASSERT (delta >= 0);
+
+	for (level = 0; level < ALARM_LEVELS - 1; level++)
+		if (delta < (int64_t) 1 << (ALARM_BITS * (level + 1)))
+			break;
+	a->level = level;
+	a->slot = (at >> (ALARM_BITS * level)) & (ALARM_SLOTS - 1);
+	list_push_back (&alarm_wheel[level][a->slot], &a->elem);
+	alarm_bitmap[level] |= 1ULL << a->slot;
+}
+
+/* Moves the alarms in slot SLOT of wheel level LEVEL, whose span
+   begins at the current tick, to the levels their expiry ticks
+   are now within. */
+static void
+alarm_cascade (int level, size_t slot) {
+	struct list *bucket = &alarm_wheel[level][slot];
+	struct list moving;
+
+	if ((alarm_bitmap[level] & (1ULL << slot)) == 0)
+		return;
+
+	/* Empty the slot first: an alarm may go back into it. */
+	list_init (&moving);
+	while (!list_empty (bucket))
+		list_push_back (&moving, list_pop_front (bucket));
+	alarm_bitmap[level] &= ~(1ULL << slot);
+
+	while (!list_empty (&moving))
+		alarm_place (list_entry (list_pop_front (&moving), struct alarm, elem));
+}
+
+/* Cascades every wheel level whose slot span begins at the
+   current tick, then fires every alarm in the current tick's
+   level-0 slot. */
+static void
+alarm_expire (void) {
+	size_t slot = ticks & (ALARM_SLOTS - 1);
+	struct list *bucket = &alarm_wheel[0][slot];
+	struct list expired;
+
+	for (int level = ALARM_LEVELS - 1; level > 0; level--) {
+		int shift = ALARM_BITS * level;
+
+		if ((ticks & (((int64_t) 1 << shift) - 1)) == 0)
+			alarm_cascade (level, (ticks >> shift) & (ALARM_SLOTS - 1));
+	}
+
+	if ((alarm_bitmap[0] & (1ULL << slot)) == 0)
+		return;
+
+	/* Collect the alarms first, so that their functions are free
+	   to arm or cancel alarms in this slot. */
+	list_init (&expired);
+	while (!list_empty (bucket)) {
+		struct alarm *a = list_entry (list_pop_front (bucket),
+				struct alarm, elem);
+
+		ASSERT (a->expires == ticks);
+		a->armed = false;
+		list_push_back (&expired, &a->elem);
+	}
+	alarm_bitmap[0] &= ~(1ULL << slot);
+
+	while (!list_empty (&expired)) {
+		struct alarm *a = list_entry (list_pop_front (&expired),
+				struct alarm, elem);
+		a->func (a);
+	}
+}
+
+/* Returns the earliest tick after the current one that has an
+   alarm to fire or a nonempty slot to cascade, or INT64_MAX if no
+   alarm is armed.  A cascade need not fire anything, so this is a
+   lower bound on the next expiry. */
+static int64_t
+alarm_next_tick (void) {
+	int64_t next = INT64_MAX;
+
+	for (int level = 0; level < ALARM_LEVELS; level++) {
+		int shift = ALARM_BITS * level;
+		uint64_t map = alarm_bitmap[level];
+		size_t from;
+		int64_t at;
+
+		if (map == 0)
+			continue;
+
+		/* Slots from the one after the current span's, around. */
+		from = ((ticks >> shift) + 1) & (ALARM_SLOTS - 1);
+		map = (map >> from) | (map << ((ALARM_SLOTS - from) % ALARM_SLOTS));
+		at = ((ticks >> shift) + 1 + __builtin_ctzll (map)) << shift;
+		if (at < next)
+			next = at;
+	}
+	return next;
+}
+
+/* Programs the 8254 to interrupt every tick. */
+static void
+pit_set_periodic (void) {
+	outb (0x43, 0x34);    /* CW: counter 0, LSB then MSB, mode 2, binary. */
+	outb (0x40, tick_count & 0xff);
+	outb (0x40, tick_count >> 8);
+}
+
+/* Programs the 8254 to interrupt once, COUNT counts from now. */
+static void
+pit_set_oneshot (unsigned count) {
+	ASSERT (count > 0 && count <= UINT16_MAX);
+
+	outb (0x43, 0x30);    /* CW: counter 0, LSB then MSB, mode 0, binary. */
+	outb (0x40, count & 0xff);
+	outb (0x40, count >> 8);
+}
+
+/* Accounts for SKIPPED ticks that passed without an interrupt
+   while the idle thread was halted, firing any alarms that came
+   due meanwhile. */
+static void
+timer_catch_up (int64_t skipped) {
+	thread_idle_ticks (skipped);
+	while (skipped-- > 0) {
+		ticks++;
+		alarm_expire ();
+	}
+}
+
 /* Timer interrupt handler. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED) {
+	if (oneshot_ticks != 0) {
+		/* A one-shot armed while idle expired. */
+		timer_catch_up (oneshot_ticks - 1);
+		oneshot_ticks = 0;
+		pit_set_periodic ();
+	}
+
 	ticks++;
 	thread_tick ();
 
@@ -140,8 +472,7 @@ timer_interrupt (struct intr_frame *args UNUSED) {
         }
     }
 
-	if (get_awake_tick () <= ticks)
-		thread_awake (ticks);
+	alarm_expire ();
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
@@ -1,12 +1,31 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
 #define TIMER_FREQ 100
 
+/* Stop the periodic tick while idle?
+   Controlled by kernel command-line option "-tickless". */
+extern bool timer_tickless;
+
+struct alarm;
+typedef void alarm_func (struct alarm *);
+
+/* A one-shot timeout, kept on the timer wheel while armed. */
+struct alarm {
+	int64_t expires;            /* Tick at which the alarm fires. */
+	struct list_elem elem;      /* Timer wheel slot element. */
+	alarm_func *func;           /* Called from the timer interrupt. */
+	void *aux;                  /* For use by FUNC. */
+	bool armed;                 /* On the timer wheel? */
+	unsigned char level, slot;  /* Timer wheel position while armed. */
+};
+
 void timer_init (void);
 void timer_calibrate (void);
 
@@ -20,4 +39,11 @@ void timer_nsleep (int64_t nanoseconds);
 
 void timer_print_stats (void);
 
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
+void alarm_init (struct alarm *, alarm_func *, void *aux);
+void alarm_arm (struct alarm *, int64_t expires);
+bool alarm_cancel (struct alarm *);
+
 #endif /* devices/timer.h */
@@ -0,0 +1,61 @@
+#ifndef __LIB_KERNEL_HEAP_H
+#define __LIB_KERNEL_HEAP_H
+
+/* Priority queue.
+
+ * This is an intrusive pairing heap: like the elements of a
+ * list, the elements of a heap are embedded in the structures
+ * they order, so the heap never allocates memory.  Insertion
+ * and finding the minimum take O(1) time; removing the minimum,
+ * or any other element, takes amortized O(log n) time.
+
+ * The ordering is given by a heap_less_func.  Elements that
+ * compare equal come out in no particular order, so give the
+ * comparison a tie-breaker if the order matters. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Heap element. */
+struct heap_elem {
+	struct heap_elem *child;    /* Leftmost child. */
+	struct heap_elem *next;     /* Next sibling to the right. */
+	struct heap_elem *prev;     /* Previous sibling, or parent if
+	                               leftmost, or null if root. */
+};
+
+/* Converts pointer to heap element HEAP_ELEM into a pointer to
+   the structure that HEAP_ELEM is embedded inside.  Supply the
+   name of the outer structure STRUCT and the member name MEMBER
+   of the heap element. */
+#define heap_entry(HEAP_ELEM, STRUCT, MEMBER)           \
+	((STRUCT *) ((uint8_t *) &(HEAP_ELEM)->next     \
+		- offsetof (STRUCT, MEMBER.next)))
+
+/* Compares the value of two heap elements A and B, given
+   auxiliary data AUX.  Returns true if A is less than B, or
+   false if A is greater than or equal to B. */
+typedef bool heap_less_func (const struct heap_elem *a,
+                             const struct heap_elem *b,
+                             void *aux);
+
+/* Heap. */
+struct heap {
+	struct heap_elem *root;     /* Minimum element, or null. */
+	size_t size;                /* Number of elements. */
+	heap_less_func *less;       /* Comparison function. */
+	void *aux;                  /* Auxiliary data for `less'. */
+};
+
+void heap_init (struct heap *, heap_less_func *, void *aux);
+
+void heap_insert (struct heap *, struct heap_elem *);
+void heap_remove (struct heap *, struct heap_elem *);
+struct heap_elem *heap_min (struct heap *);
+struct heap_elem *heap_pop_min (struct heap *);
+
+size_t heap_size (struct heap *);
+bool heap_empty (struct heap *);
+
+#endif /* lib/kernel/heap.h */
@@ -0,0 +1,24 @@
+#ifndef THREADS_HEAPSTAT_H
+#define THREADS_HEAPSTAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel heap accounting, kept only in a kernel built with
+   HEAPSTAT defined.  Each allocation is charged to a tag, one per
+   allocation site, that records live and peak bytes. */
+
+/* Kinds of allocation. */
+enum heapstat_kind {
+	HEAPSTAT_PAGES,             /* palloc_get_*(). */
+	HEAPSTAT_MALLOC             /* malloc() and friends. */
+};
+
+#ifdef HEAPSTAT
+uint8_t heapstat_alloc (enum heapstat_kind, const void *site, size_t bytes);
+void heapstat_free (uint8_t tag, size_t bytes);
+void heapstat_print (void);
+void heapstat_init_intr (void);
+#endif
+
+#endif /* threads/heapstat.h */
@@ -4,10 +4,24 @@
 #include <debug.h>
 #include <stddef.h>
 
+/* Size classes, from the smallest, that have magazines: blocks
+   of up to 1 kB. */
+#define MALLOC_MAG_CLASSES 7
+
+/* A thread's cache of free blocks of one size class, which it
+   allocates from and frees to without taking the class's lock. */
+struct malloc_magazine {
+	void *blocks;               /* Chain of free blocks. */
+	size_t cnt;                 /* Number of blocks in chain. */
+};
+
 void malloc_init (void);
 void *malloc (size_t) __attribute__ ((malloc));
 void *calloc (size_t, size_t) __attribute__ ((malloc));
 void *realloc (void *, size_t);
 void free (void *);
+size_t malloc_page_cnt (void);
+void malloc_print_stats (void);
+void malloc_drain (void);
 
 #endif /* threads/malloc.h */
@@ -1,6 +1,7 @@
 #ifndef THREADS_PALLOC_H
 #define THREADS_PALLOC_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -8,16 +9,32 @@
 enum palloc_flags {
 	PAL_ASSERT = 001,           /* Panic on failure. */
 	PAL_ZERO = 002,             /* Zero page contents. */
-	PAL_USER = 004              /* User page. */
+	PAL_USER = 004,             /* User page. */
+	PAL_RESERVE = 010           /* May use the emergency reserve. */
 };
 
+/* A reclaim hook.  Frees up to PAGE_CNT pages back to the page
+   allocator and returns the number of pages it freed.  Called
+   with interrupts on, outside interrupt context, and never
+   reentered for the same pool.  It runs in whichever thread is
+   allocating, inside palloc_get_page() and the like, so it must
+   not acquire a lock that any thread may hold while it allocates
+   pages, or that thread deadlocks against itself. */
+typedef size_t palloc_reclaim_func (size_t page_cnt);
+
 /* Maximum number of pages to put in user pool. */
 extern size_t user_page_limit;
 
 uint64_t palloc_init (void);
 void *palloc_get_page (enum palloc_flags);
 void *palloc_get_multiple (enum palloc_flags, size_t page_cnt);
+void *palloc_get_large (enum palloc_flags);
 void palloc_free_page (void *);
 void palloc_free_multiple (void *, size_t page_cnt);
+bool palloc_share_page (void *);
+bool palloc_page_shared (void *);
+void palloc_add_reclaim (enum palloc_flags, palloc_reclaim_func *);
+void palloc_zero_idle (void);
+void palloc_print_stats (void);
 
 #endif /* threads/palloc.h */
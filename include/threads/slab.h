@@ -0,0 +1,17 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <stddef.h>
+
+/* Initializes a newly created object OBJ of a cache, given the
+   auxiliary data AUX. */
+typedef void kmem_ctor_func (void *obj, void *aux);
+
+struct kmem_cache *kmem_cache_create (const char *name, size_t size,
+		kmem_ctor_func *, void *aux);
+void *kmem_cache_alloc (struct kmem_cache *);
+void kmem_cache_free (struct kmem_cache *, void *);
+size_t kmem_cache_page_cnt (struct kmem_cache *);
+void kmem_print_stats (void);
+
+#endif /* threads/slab.h */
@@ -0,0 +1,30 @@
+#ifndef THREADS_SWITCH_H
+#define THREADS_SWITCH_H
+
+#ifndef __ASSEMBLER__
+#include <stdint.h>
+
+/* switch_context()'s stack frame: the callee-saved registers,
+   pushed in this order on top of the return address. */
+struct switch_frame {
+	uint64_t r15;               /*  0: Saved %r15. */
+	uint64_t r14;               /*  8: Saved %r14. */
+	uint64_t r13;               /* 16: Saved %r13. */
+	uint64_t r12;               /* 24: Saved %r12. */
+	uint64_t rbp;               /* 32: Saved %rbp. */
+	uint64_t rbx;               /* 40: Saved %rbx. */
+	void (*rip) (void);         /* 48: Return address. */
+};
+
+/* Saves the running thread's callee-saved registers on its stack
+   and its stack pointer in *CUR_RSP, then resumes the thread
+   whose stack pointer is NEXT_RSP. */
+void switch_context (uint64_t *cur_rsp, uint64_t next_rsp);
+
+/* Where a new thread's first switch_context() returns to.  Its
+   frame's %r12 holds the thread's intr_frame, which switch_entry
+   passes to do_iret() to launch the thread. */
+void switch_entry (void);
+#endif
+
+#endif /* threads/switch.h */
@@ -1,13 +1,16 @@
 #ifndef THREADS_SYNCH_H
 #define THREADS_SYNCH_H
 
+#include <heap.h>
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
 
 /* A counting semaphore. */
 struct semaphore {
 	unsigned value;             /* Current value. */
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, most urgent first. */
 };
 
 void sema_init (struct semaphore *, unsigned value);
@@ -15,12 +18,37 @@ void sema_down (struct semaphore *);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
-bool sema_compare_priority (const struct list_elem *a, const struct list_elem *b, void *aux);
+
+#ifdef LOCKSTAT
+#define LOCKSTAT_HOLDERS 4      /* # of top holders kept per lock. */
+
+/* Contention statistics for a lock, kept only in a kernel built
+   with LOCKSTAT defined.  Times are in TSC cycles. */
+struct lock_stat {
+	const char *name;           /* Name, or null if unregistered. */
+	struct lock_stat *next;     /* Next registered lock. */
+	uint64_t acquired;          /* # of acquisitions. */
+	uint64_t contended;         /* # of acquisitions that waited. */
+	uint64_t wait_cycles;       /* Total time spent waiting. */
+	uint64_t max_wait_cycles;   /* Longest wait. */
+	uint64_t hold_cycles;       /* Total time held. */
+	uint64_t max_hold_cycles;   /* Longest hold. */
+	uint64_t acquire_tsc;       /* When the holder acquired it. */
+	struct {
+		char name[16];          /* Thread name. */
+		uint64_t cnt;           /* # of acquisitions, approximate. */
+	} holders[LOCKSTAT_HOLDERS];/* Most frequent holders. */
+};
+#endif
 
 /* Lock. */
 struct lock {
 	struct thread *holder;      /* Thread holding lock (for debugging). */
 	struct semaphore semaphore; /* Binary semaphore controlling access. */
+	struct list_elem elem;      /* Element in holder's held_locks. */
+#ifdef LOCKSTAT
+	struct lock_stat stat;      /* Contention statistics. */
+#endif
 };
 
 void lock_init (struct lock *);
@@ -29,9 +57,16 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+#ifdef LOCKSTAT
+void lock_set_name (struct lock *, const char *name);
+void lockstat_print (void);
+#else
+#define lock_set_name(LOCK, NAME) ((void) 0)
+#endif
+
 /* Condition variable. */
 struct condition {
-	struct list waiters;        /* List of waiting threads. */
+	struct heap waiters;        /* Waiting threads, most urgent first. */
 };
 
 void cond_init (struct condition *);
@@ -39,6 +74,35 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock {
+	struct lock lock;           /* Held by the writer, and by readers
+	                               only while they enter. */
+	unsigned readers;           /* Number of readers inside. */
+	bool writer_waiting;        /* Writer waiting for readers to leave? */
+	struct semaphore drained;   /* Upped when the last reader leaves. */
+};
+
+void rwlock_init (struct rwlock *);
+void rwlock_read_acquire (struct rwlock *);
+void rwlock_read_release (struct rwlock *);
+void rwlock_write_acquire (struct rwlock *);
+void rwlock_write_release (struct rwlock *);
+
+/* Sequence lock. */
+struct seqlock {
+	unsigned seq;               /* Odd while a write is in progress. */
+	enum intr_level old_level;  /* Interrupt level before the write. */
+};
+
+void seqlock_init (struct seqlock *);
+unsigned seqlock_read_begin (const struct seqlock *);
+bool seqlock_read_retry (const struct seqlock *, unsigned start);
+void seqlock_write_begin (struct seqlock *);
+void seqlock_write_end (struct seqlock *);
+
+void synch_requeue (struct thread *);
+
 /* Optimization barrier.
  *
  * The compiler will not reorder operations across an
@@ -2,9 +2,12 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <heap.h>
 #include <list.h>
 #include <stdint.h>
+#include "devices/timer.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/synch.h"
 #ifdef VM
 #include "vm/vm.h"
@@ -24,6 +27,9 @@ enum thread_status {
 typedef int tid_t;
 #define TID_ERROR ((tid_t) -1)          /* Error value for tid_t. */
 
+/* No EDF deadline: later than any real deadline. */
+#define EDF_NONE INT64_MAX
+
 /* Thread priorities. */
 #define PRI_MIN 0                       /* Lowest priority. */
 #define PRI_DEFAULT 31                  /* Default priority. */
@@ -80,32 +86,48 @@ typedef int tid_t;
  * the `magic' member of the running thread's `struct thread' is
  * set to THREAD_MAGIC.  Stack overflow will normally change this
  * value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
- * the run queue (thread.c), or it can be an element in a
- * semaphore wait list (synch.c).  It can be used these two ways
- * only because they are mutually exclusive: only a thread in the
- * ready state is on the run queue, whereas only a thread in the
- * blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in the run queue (thread.c).
+ * A thread blocked on a semaphore is kept in its wait queue
+ * (synch.c) through `wait_elem' instead. */
 struct thread {
 	/* Owned by thread.c. */
 	tid_t tid;                          /* Thread identifier. */
 	enum thread_status status;          /* Thread state. */
 	char name[16];                      /* Name (for debugging purposes). */
 	int priority;                       /* Priority. */
-	int64_t wakeup_tick;
+	struct alarm sleep_alarm;           /* Ends a thread_sleep(). */
 	int init_priority;
 	int nice;
 	int recent_cpu;
+	int64_t mlfqs_epoch;                /* # of recent_cpu decays applied. */
+	bool mlfqs_dirty;                   /* On the MLFQS dirty list? */
+	int64_t vruntime;                   /* Weighted CPU time, for -fair. */
+	uint64_t fair_seq;                  /* Run queue insertion order. */
+	int64_t deadline;                   /* EDF deadline in effect, own or
+	                                       inherited, or EDF_NONE. */
+	int64_t edf_runtime;                /* EDF budget per period, or 0. */
+	int64_t edf_deadline;               /* EDF deadline, from period start. */
+	int64_t edf_period;                 /* EDF period. */
+	int64_t edf_job_deadline;           /* Deadline in the current period. */
+	int64_t edf_budget;                 /* Budget left this period. */
+	bool edf_throttled;                 /* Budget used up this period? */
+	struct alarm edf_alarm;             /* Starts the next EDF period. */
 	int next_fd;
 	int exit_status;
 
 	/* Shared between thread.c and synch.c. */
-	struct lock *wait_on_lock;
-	struct list donations;
+	struct lock *wait_on_lock;          /* Lock waited for, or null. */
+	struct list held_locks;             /* Locks held. */
 	struct list child_list;
-	struct list_elem donation_elem;
 	struct list_elem elem;              /* List element. */
+	struct semaphore *wait_sema;        /* Semaphore waited on, or null. */
+	struct semaphore_elem *wait_cond;   /* Condition wait entry, or null. */
+	struct heap_elem wait_elem;         /* Semaphore wait queue element. */
+	uint64_t wait_seq;                  /* Wait queue insertion order. */
 	struct list_elem all_elem;
+	struct list_elem mlfqs_elem;        /* MLFQS dirty list element. */
+	struct list_elem mlfqs_wait_elem;   /* MLFQS waiter list element. */
+	struct heap_elem fair_elem;         /* -fair run queue element. */
 	struct list_elem child_elem;
 	struct semaphore sema_exit;
 	struct semaphore sema_fork;
@@ -113,6 +135,9 @@ struct thread {
 	struct file *running_file;
 	struct file **fdt;
 
+	/* Owned by threads/malloc.c. */
+	struct malloc_magazine mags[MALLOC_MAG_CLASSES];
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
@@ -123,7 +148,9 @@ struct thread {
 #endif
 
 	/* Owned by thread.c. */
-	struct intr_frame tf;               /* Information for switching */
+	uint64_t ctx_rsp;                   /* Saved stack pointer while
+	                                       switched out. */
+	struct intr_frame tf;               /* Information for launching */
 	struct intr_frame ptf;
 	unsigned magic;                     /* Detects stack overflow. */
 };
@@ -133,11 +160,22 @@ struct thread {
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the proportional-share scheduler instead.
+   Controlled by kernel command-line option "-fair". */
+extern bool thread_fair;
+
+/* If true, record scheduler events for thread_trace_dump().
+   Controlled by kernel command-line option "-sched-trace". */
+extern bool thread_trace;
+
 void thread_init (void);
 void thread_start (void);
 
 void thread_tick (void);
 void thread_print_stats (void);
+size_t thread_cache_shrink (size_t page_cnt);
+void thread_idle_ticks (int64_t ticks);
+void thread_trace_dump (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -155,6 +193,8 @@ void thread_yield (void);
 int thread_get_priority (void);
 void thread_set_priority (int);
 
+bool thread_set_edf (int64_t runtime, int64_t deadline, int64_t period);
+
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
@@ -162,17 +202,11 @@ int thread_get_load_avg (void);
 
 void do_iret (struct intr_frame *tf);
 
-int64_t get_awake_tick (void);
-void next_awake_tick (int64_t ticks);
 void thread_sleep (int64_t ticks);
-void thread_awake (int64_t ticks);
 
-bool compare_priority (struct list_elem *a, struct list_elem *b, void *aux);
 void preemption_priority (void);
 
-bool compare_donation_priority (const struct list_elem *a, const struct list_elem *b, void *aux);
 void donate_priority (void);
-void remove_donations_lock (struct lock *lock);
 void reset_priority (void);
 
 void mlfqs_increase_recent_cpu (void);
@@ -181,5 +215,9 @@ void mlfqs_recalc_recent_cpu (void);
 void mlfqs_update_priority (struct thread *t);
 void mlfqs_update_recent_cpu (struct thread *t);
 void mlfqs_update_load_avg (void);
+void mlfqs_refresh (struct thread *t);
+void mlfqs_wait_begin (struct thread *t);
+void mlfqs_wait_end (struct thread *t);
+bool mlfqs_pass_pending (void);
 
 #endif /* threads/thread.h */
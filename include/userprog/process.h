@@ -3,6 +3,11 @@
 
 #include "threads/thread.h"
 
+/* If true, map 2 MB runs of zero-filled user memory, such as a
+   large BSS, with 2 MB pages.  Set by the "-large-pages" kernel
+   command-line option. */
+extern bool process_large_pages;
+
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
 int process_exec (void *f_name);
@@ -11,5 +16,8 @@ void process_exit (void);
 void process_activate (struct thread *next);
 void argument_stack (char **argv, int argc, struct intr_frame *if_);
 struct thread *get_child_process (int pid);
+bool process_cow_fault (void *addr);
+bool process_cow_unshare (void *buffer, size_t size);
+void process_print_stats (void);
 
 #endif /* userprog/process.h */
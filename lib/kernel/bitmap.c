@@ -63,6 +63,36 @@ last_mask (const struct bitmap *b) {
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns element IDX of B with its bits inverted if VALUE is
+   false, so that the bits set to VALUE are 1. */
+static inline elem_type
+elem_value (const struct bitmap *b, size_t idx, bool value) {
+	return value ? b->bits[idx] : ~b->bits[idx];
+}
+
+/* Returns a mask of the bits in the element that contains bit
+   START that lie between START and END, exclusive, and advances
+   START past them. */
+static inline elem_type
+next_mask (size_t *start, size_t end) {
+	size_t ofs = *start % ELEM_BITS;
+	size_t bits = ELEM_BITS - ofs < end - *start ? ELEM_BITS - ofs : end - *start;
+	elem_type mask = bits < ELEM_BITS ? ((elem_type) 1 << bits) - 1 : (elem_type) -1;
+
+	*start += bits;
+	return mask << ofs;
+}
+
+/* Returns the number of 1-bits in X.  (GCC's __builtin_popcountl()
+   may call a libgcc routine, which the kernel does not link.) */
+static inline size_t
+popcount (elem_type x) {
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (x * 0x0101010101010101UL) >> 56;
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -194,33 +224,42 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.  Each
+   element is updated atomically. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		elem_type mask = next_mask (&start, end);
+
+		if (value)
+			asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+		else
+			asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt, value_cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
 	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		value_cnt += popcount (elem_value (b, idx, value) & next_mask (&start, end));
+	}
 	return value_cnt;
 }
 
@@ -228,15 +267,17 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		if (elem_value (b, idx, value) & next_mask (&start, end))
 			return true;
+	}
 	return false;
 }
 
@@ -266,18 +307,58 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt) {
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   Works a word at a time: the length of the run of VALUE bits
+   ending at I is carried from word to word, whole words of VALUE
+   extend it at once, and within a word the ends of runs are
+   found with count-trailing-zeros. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
+	size_t i, run;
+
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 
-	if (cnt <= b->bit_cnt) {
-		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
-				return i;
+	if (cnt > b->bit_cnt)
+		return BITMAP_ERROR;
+	if (cnt == 0)
+		return start;
+
+	i = start;
+	run = 0;
+	while (i < b->bit_cnt) {
+		size_t ofs = i % ELEM_BITS;
+		size_t bits = ELEM_BITS - ofs < b->bit_cnt - i
+			? ELEM_BITS - ofs : b->bit_cnt - i;
+		elem_type full = bits < ELEM_BITS
+			? ((elem_type) 1 << bits) - 1 : (elem_type) -1;
+		elem_type x = (elem_value (b, elem_idx (i), value) >> ofs) & full;
+		size_t ones, rest;
+
+		if (x == full) {
+			/* The run continues through this word. */
+			run += bits;
+			i += bits;
+			if (run >= cnt)
+				return i - run;
+			continue;
+		}
+
+		/* The run ends within this word, after ONES more bits. */
+		ones = __builtin_ctzl (~x);
+		run += ones;
+		if (run >= cnt)
+			return i + ones - run;
+
+		/* Skip to the next VALUE bit in the word, if any, to start
+		   a new run there. */
+		run = 0;
+		rest = ones + 1 < bits ? x >> (ones + 1) : 0;
+		if (rest == 0)
+			i += bits;
+		else
+			i += ones + 1 + __builtin_ctzl (rest);
 	}
 	return BITMAP_ERROR;
 }
@@ -0,0 +1,166 @@
+#include "heap.h"
+#include "../debug.h"
+
+/* A pairing heap is a tree in which each node is no greater than
+   any of its children.  A node's children form a doubly linked
+   list starting at its `child' link; the leftmost child's `prev'
+   link points back to the parent.
+
+   Two trees are melded by making the root with the greater key
+   the leftmost child of the other.  Removing the root leaves a
+   list of subtrees, which are melded in pairs from left to right
+   and then the pairs are melded from right to left.  This
+   "two-pass" rule is what gives the amortized O(log n) bound.
+
+   See M. L. Fredman, R. Sedgewick, D. D. Sleator, and R. E.
+   Tarjan, "The pairing heap: A new form of self-adjusting heap",
+   Algorithmica 1 (1986). */
+
+static struct heap_elem *meld (struct heap *,
+		struct heap_elem *, struct heap_elem *);
+static struct heap_elem *merge_pairs (struct heap *,
+		struct heap_elem *first);
+
+/* Initializes HEAP as an empty heap ordered by LESS given
+   auxiliary data AUX. */
+void
+heap_init (struct heap *heap, heap_less_func *less, void *aux) {
+	ASSERT (heap != NULL);
+	ASSERT (less != NULL);
+
+	heap->root = NULL;
+	heap->size = 0;
+	heap->less = less;
+	heap->aux = aux;
+}
+
+/* Inserts ELEM into HEAP. */
+void
+heap_insert (struct heap *heap, struct heap_elem *elem) {
+	ASSERT (heap != NULL);
+	ASSERT (elem != NULL);
+
+	elem->child = elem->next = elem->prev = NULL;
+	heap->root = meld (heap, heap->root, elem);
+	heap->size++;
+}
+
+/* Removes ELEM, which must be in HEAP, from HEAP. */
+void
+heap_remove (struct heap *heap, struct heap_elem *elem) {
+	struct heap_elem *sub;
+
+	ASSERT (heap != NULL);
+	ASSERT (elem != NULL);
+	ASSERT (heap->size > 0);
+
+	if (elem == heap->root) {
+		heap_pop_min (heap);
+		return;
+	}
+
+	/* Unlink ELEM and its subtree from its parent's children,
+	   then meld the remainder of its subtree back in. */
+	if (elem->prev->child == elem)
+		elem->prev->child = elem->next;
+	else
+		elem->prev->next = elem->next;
+	if (elem->next != NULL)
+		elem->next->prev = elem->prev;
+
+	sub = merge_pairs (heap, elem->child);
+	heap->root = meld (heap, heap->root, sub);
+	heap->size--;
+}
+
+/* Returns the minimum element of HEAP.
+   Undefined behavior if HEAP is empty. */
+struct heap_elem *
+heap_min (struct heap *heap) {
+	ASSERT (!heap_empty (heap));
+	return heap->root;
+}
+
+/* Removes and returns the minimum element of HEAP.
+   Undefined behavior if HEAP is empty. */
+struct heap_elem *
+heap_pop_min (struct heap *heap) {
+	struct heap_elem *min = heap_min (heap);
+
+	heap->root = merge_pairs (heap, min->child);
+	heap->size--;
+	return min;
+}
+
+/* Returns the number of elements in HEAP. */
+size_t
+heap_size (struct heap *heap) {
+	return heap->size;
+}
+
+/* Returns true if HEAP is empty, false otherwise. */
+bool
+heap_empty (struct heap *heap) {
+	return heap->root == NULL;
+}
+
+/* Melds the trees rooted at A and B, either of which may be
+   null, and returns the root of the result. */
+static struct heap_elem *
+meld (struct heap *heap, struct heap_elem *a, struct heap_elem *b) {
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+
+	if (heap->less (b, a, heap->aux)) {
+		struct heap_elem *t = a;
+		a = b;
+		b = t;
+	}
+
+	/* Make B the leftmost child of A. */
+	b->prev = a;
+	b->next = a->child;
+	if (a->child != NULL)
+		a->child->prev = b;
+	a->child = b;
+
+	a->next = a->prev = NULL;
+	return a;
+}
+
+/* Melds the list of sibling trees starting at FIRST into a
+   single tree by the two-pass rule and returns its root. */
+static struct heap_elem *
+merge_pairs (struct heap *heap, struct heap_elem *first) {
+	struct heap_elem *pairs = NULL;
+	struct heap_elem *root = NULL;
+
+	/* First pass: meld adjacent pairs from left to right,
+	   stacking the results through their `next' links. */
+	while (first != NULL) {
+		struct heap_elem *a = first;
+		struct heap_elem *b = a->next;
+
+		first = b != NULL ? b->next : NULL;
+		a->next = a->prev = NULL;
+		if (b != NULL)
+			b->next = b->prev = NULL;
+
+		a = meld (heap, a, b);
+		a->next = pairs;
+		pairs = a;
+	}
+
+	/* Second pass: meld the pairs from right to left. */
+	while (pairs != NULL) {
+		struct heap_elem *next = pairs->next;
+
+		pairs->next = NULL;
+		root = meld (heap, root, pairs);
+		pairs = next;
+	}
+
+	return root;
+}
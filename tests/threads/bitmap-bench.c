@@ -0,0 +1,100 @@
+/* Compares word-at-a-time bitmap_scan() and bitmap_count() with
+   the bit-at-a-time loops they replaced, on a fragmented map of
+   MAP_BITS bits: free runs of 1 to RUN_CNT - 1 bits separated by
+   single used bits, with one free run of RUN_CNT bits at the
+   end.  Checks that both find the same results and that the
+   word-at-a-time versions are the faster. */
+
+#include <bitmap.h>
+#include <inttypes.h>
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "intrinsic.h"
+
+#define MAP_BITS (1024 * 1024)
+#define RUN_CNT 64
+
+static size_t old_scan (const struct bitmap *, size_t cnt, bool value);
+static size_t old_count (const struct bitmap *, bool value);
+
+void
+test_bitmap_bench (void) 
+{
+  struct bitmap *map;
+  uint64_t start, old_cycles, new_cycles;
+  size_t i, run, old_idx, new_idx, old_cnt, new_cnt;
+
+  map = bitmap_create (MAP_BITS);
+  if (map == NULL)
+    fail ("bitmap_create failed");
+
+  /* Fragment the map. */
+  random_init (0);
+  bitmap_set_all (map, true);
+  for (i = 0; i + 2 * RUN_CNT < MAP_BITS; i += run + 1) 
+    {
+      run = random_ulong () % (RUN_CNT - 1) + 1;
+      bitmap_set_multiple (map, i, run, false);
+    }
+  bitmap_set_multiple (map, MAP_BITS - RUN_CNT, RUN_CNT, false);
+
+  start = rdtsc ();
+  old_idx = old_scan (map, RUN_CNT, false);
+  old_cycles = rdtsc () - start;
+  start = rdtsc ();
+  new_idx = bitmap_scan (map, 0, RUN_CNT, false);
+  new_cycles = rdtsc () - start;
+  if (old_idx != new_idx || new_idx != MAP_BITS - RUN_CNT)
+    fail ("scan found %zu, expected %zu", new_idx, MAP_BITS - RUN_CNT);
+  if (new_cycles >= old_cycles)
+    fail ("word-at-a-time scan took %"PRIu64" cycles, no faster than "
+          "%"PRIu64" bit at a time", new_cycles, old_cycles);
+  msg ("Word-at-a-time scan for %d free bits was faster.", RUN_CNT);
+
+  start = rdtsc ();
+  old_cnt = old_count (map, false);
+  old_cycles = rdtsc () - start;
+  start = rdtsc ();
+  new_cnt = bitmap_count (map, 0, MAP_BITS, false);
+  new_cycles = rdtsc () - start;
+  if (old_cnt != new_cnt)
+    fail ("count found %zu, expected %zu", new_cnt, old_cnt);
+  if (new_cycles >= old_cycles)
+    fail ("word-at-a-time count took %"PRIu64" cycles, no faster than "
+          "%"PRIu64" bit at a time", new_cycles, old_cycles);
+  msg ("Word-at-a-time count was faster.");
+
+  bitmap_destroy (map);
+  pass ();
+}
+
+/* The old bitmap_scan() from bit 0. */
+static size_t
+old_scan (const struct bitmap *b, size_t cnt, bool value) 
+{
+  size_t i, j;
+
+  for (i = 0; i + cnt <= bitmap_size (b); i++) 
+    {
+      for (j = 0; j < cnt; j++)
+        if (bitmap_test (b, i + j) != value)
+          break;
+      if (j == cnt)
+        return i;
+    }
+  return BITMAP_ERROR;
+}
+
+/* The old bitmap_count() over all of B. */
+static size_t
+old_count (const struct bitmap *b, bool value) 
+{
+  size_t i, cnt = 0;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    if (bitmap_test (b, i) == value)
+      cnt++;
+  return cnt;
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(bitmap-bench) begin
+(bitmap-bench) Word-at-a-time scan for 64 free bits was faster.
+(bitmap-bench) Word-at-a-time count was faster.
+(bitmap-bench) PASS
+(bitmap-bench) end
+EOF
+pass;
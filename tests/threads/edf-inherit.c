@@ -0,0 +1,68 @@
+/* Checks EDF admission control and deadline inheritance.
+
+   The main thread holds a lock that an EDF thread then blocks
+   on.  The EDF thread has the lowest priority, so priority
+   donation alone does nothing for the main thread, but it
+   inherits the EDF thread's deadline and so must keep running
+   even after it creates a thread of the highest priority.  When
+   the main thread releases the lock, the EDF thread must run
+   before the high-priority thread. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func edf_thread_func;
+static thread_func high_thread_func;
+
+void
+test_edf_inherit (void) 
+{
+  struct lock lock;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  if (thread_set_edf (10, 5, 20))
+    fail ("admitted runtime longer than deadline");
+  if (!thread_set_edf (60, 100, 100))
+    fail ("rejected 60%% bandwidth");
+  if (thread_set_edf (100, 100, 100))
+    fail ("admitted 100%% bandwidth");
+  if (!thread_set_edf (0, 0, 0))
+    fail ("could not leave EDF class");
+  msg ("Admission control works.");
+
+  lock_init (&lock);
+  lock_acquire (&lock);
+  thread_create ("edf", PRI_DEFAULT + 1, edf_thread_func, &lock);
+  thread_create ("high", PRI_MAX, high_thread_func, NULL);
+  msg ("Main thread should run before the high-priority thread.");
+  lock_release (&lock);
+  msg ("Main thread finished.");
+}
+
+static void
+edf_thread_func (void *lock_) 
+{
+  struct lock *lock = lock_;
+
+  if (!thread_set_edf (20, 50, 100))
+    fail ("rejected 40%% bandwidth");
+  thread_set_priority (PRI_MIN);
+  msg ("EDF thread admitted, waiting for the lock.");
+  lock_acquire (lock);
+  msg ("EDF thread got the lock.");
+  lock_release (lock);
+  msg ("EDF thread finished.");
+  thread_set_edf (0, 0, 0);
+}
+
+static void
+high_thread_func (void *aux UNUSED) 
+{
+  msg ("High-priority thread ran.");
+}
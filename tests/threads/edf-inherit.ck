@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-inherit) begin
+(edf-inherit) Admission control works.
+(edf-inherit) EDF thread admitted, waiting for the lock.
+(edf-inherit) Main thread should run before the high-priority thread.
+(edf-inherit) EDF thread got the lock.
+(edf-inherit) EDF thread finished.
+(edf-inherit) High-priority thread ran.
+(edf-inherit) Main thread finished.
+(edf-inherit) end
+EOF
+pass;
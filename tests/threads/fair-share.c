@@ -0,0 +1,72 @@
+/* Checks that the -fair scheduler divides the CPU by weight.
+   Two threads spin for 10 seconds, one at nice 0 and the other at
+   nice 5.  Their weights are 1024 and 335, so they should receive
+   about 75% and 25% of the ticks, a ratio of about 3 to 1. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+struct thread_info 
+  {
+    int64_t start_time;
+    int tick_count;
+    int nice;
+  };
+
+static thread_func load_thread;
+
+void
+test_fair_share (void) 
+{
+  struct thread_info info[2];
+  int64_t start_time;
+  int i;
+
+  ASSERT (thread_fair);
+
+  start_time = timer_ticks ();
+  for (i = 0; i < 2; i++) 
+    {
+      info[i].start_time = start_time;
+      info[i].tick_count = 0;
+      info[i].nice = i * 5;
+      thread_create (i == 0 ? "nice 0" : "nice 5", PRI_DEFAULT,
+                     load_thread, &info[i]);
+    }
+
+  msg ("Sleeping 12 seconds to let threads run, please wait...");
+  timer_sleep (12 * TIMER_FREQ);
+
+  if (info[1].tick_count == 0
+      || info[0].tick_count * 10 < info[1].tick_count * 25
+      || info[0].tick_count * 10 > info[1].tick_count * 37)
+    fail ("nice 0 received %d ticks and nice 5 received %d, "
+          "but their ratio should be between 2.5 and 3.7",
+          info[0].tick_count, info[1].tick_count);
+  msg ("Thread at nice 0 received about 3 times the ticks of nice 5.");
+  pass ();
+}
+
+static void
+load_thread (void *ti_) 
+{
+  struct thread_info *ti = ti_;
+  int64_t sleep_time = 1 * TIMER_FREQ;
+  int64_t spin_time = sleep_time + 10 * TIMER_FREQ;
+  int64_t last_time = 0;
+
+  thread_set_nice (ti->nice);
+  timer_sleep (sleep_time - timer_elapsed (ti->start_time));
+  while (timer_elapsed (ti->start_time) < spin_time) 
+    {
+      int64_t cur_time = timer_ticks ();
+      if (cur_time != last_time)
+        ti->tick_count++;
+      last_time = cur_time;
+    }
+}
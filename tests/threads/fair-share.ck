@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(fair-share) begin
+(fair-share) Sleeping 12 seconds to let threads run, please wait...
+(fair-share) Thread at nice 0 received about 3 times the ticks of nice 5.
+(fair-share) PASS
+(fair-share) end
+EOF
+pass;
@@ -0,0 +1,148 @@
+/* Replays a trace of kernel-like allocations through malloc()
+   and compares the pages it holds at the peak with what
+   power-of-2 block sizes in one-page arenas would have needed.
+   Sizes are drawn from a mix modelled on the kernel's own
+   allocations: open files and directories, small bookkeeping
+   structures, sector buffers, directory buffers, and larger
+   buffers such as FAT chunks.  The old scheme is counted as if
+   its arenas were packed perfectly, so its figure is a lower
+   bound, and the size classes must not exceed it. */
+
+#include <random.h>
+#include <round.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+
+#define OP_CNT 20000
+#define SLOT_CNT 256
+
+/* A range of allocation sizes, drawn WEIGHT times in 100. */
+struct size_range
+  {
+    size_t min, max;
+    int weight;
+  };
+
+static const struct size_range ranges[] =
+  {
+    {16, 16, 30},               /* struct file, struct dir. */
+    {24, 64, 20},               /* Small bookkeeping structures. */
+    {512, 512, 20},             /* Sector buffers. */
+    {600, 1400, 10},            /* Directory buffers. */
+    {1500, 3000, 10},           /* Medium buffers. */
+    {3000, 6000, 10},           /* FAT chunks. */
+  };
+
+#define RANGE_CNT (sizeof ranges / sizeof *ranges)
+
+/* Power-of-2 classes of the old scheme: 16 to 1024 bytes. */
+#define OLD_CLASS_CNT 7
+#define OLD_ARENA_HDR 24
+
+struct slot
+  {
+    void *block;                /* Block, or null. */
+    size_t size;                /* Size requested. */
+  };
+
+static struct slot slots[SLOT_CNT];
+static size_t old_live[OLD_CLASS_CNT];
+static size_t old_big_pages;
+
+static size_t random_size (void);
+static void old_account (size_t size, int delta);
+static size_t old_pages (void);
+
+void
+test_malloc_bench (void) 
+{
+  size_t base_pages, peak_old, peak_new;
+  int i;
+
+  random_init (0);
+  base_pages = malloc_page_cnt ();
+  peak_old = peak_new = 0;
+  for (i = 0; i < OP_CNT; i++) 
+    {
+      struct slot *s = &slots[random_ulong () % SLOT_CNT];
+
+      if (s->block != NULL) 
+        {
+          free (s->block);
+          s->block = NULL;
+          old_account (s->size, -1);
+        }
+      else 
+        {
+          size_t pages;
+
+          s->size = random_size ();
+          s->block = malloc (s->size);
+          if (s->block == NULL)
+            fail ("malloc(%zu) failed", s->size);
+          old_account (s->size, 1);
+
+          pages = malloc_page_cnt () - base_pages;
+          if (pages > peak_new)
+            peak_new = pages;
+          if (old_pages () > peak_old)
+            peak_old = old_pages ();
+        }
+    }
+  for (i = 0; i < SLOT_CNT; i++)
+    free (slots[i].block);
+
+  if (peak_new > peak_old)
+    fail ("size classes held %zu pages at peak, power-of-2 classes "
+          "need only %zu", peak_new, peak_old);
+  msg ("Size classes held no more pages at peak than power-of-2 "
+       "classes.");
+  pass ();
+}
+
+/* Returns a random allocation size drawn from RANGES. */
+static size_t
+random_size (void) 
+{
+  int pick = random_ulong () % 100;
+  size_t i;
+
+  for (i = 0; i < RANGE_CNT - 1; i++) 
+    {
+      if (pick < ranges[i].weight)
+        break;
+      pick -= ranges[i].weight;
+    }
+  return ranges[i].min + random_ulong () % (ranges[i].max - ranges[i].min + 1);
+}
+
+/* Adds DELTA blocks of SIZE bytes to the old scheme's count. */
+static void
+old_account (size_t size, int delta) 
+{
+  size_t block = 16;
+  int i;
+
+  for (i = 0; i < OLD_CLASS_CNT; i++, block *= 2)
+    if (block >= size) 
+      {
+        old_live[i] += delta;
+        return;
+      }
+  old_big_pages += delta * DIV_ROUND_UP (size + OLD_ARENA_HDR, PGSIZE);
+}
+
+/* Returns the fewest pages the old scheme could hold its live
+   blocks in. */
+static size_t
+old_pages (void) 
+{
+  size_t pages = old_big_pages, block = 16;
+  int i;
+
+  for (i = 0; i < OLD_CLASS_CNT; i++, block *= 2)
+    pages += DIV_ROUND_UP (old_live[i], (PGSIZE - OLD_ARENA_HDR) / block);
+  return pages;
+}
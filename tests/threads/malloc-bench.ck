@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(malloc-bench) begin
+(malloc-bench) Size classes held no more pages at peak than power-of-2 classes.
+(malloc-bench) PASS
+(malloc-bench) end
+EOF
+pass;
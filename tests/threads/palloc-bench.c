@@ -0,0 +1,98 @@
+/* Exercises the buddy page allocator.  Runs a random sequence
+   of allocations and frees of 1 to MAX_PAGES pages, with up to
+   SLOT_CNT runs live at once, against the user pool.  Then, with
+   the last runs still live, it checks that PROBE_PAGES
+   contiguous pages can still be found, as a measure of
+   fragmentation.  The allocator must never fail, must find the
+   PROBE_PAGES run, and must never hand out a page that is
+   already in use. */
+
+#include <random.h>
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define OP_CNT 20000
+#define SLOT_CNT 64
+#define MAX_PAGES 16
+#define PROBE_PAGES 64
+
+struct slot
+  {
+    void *pages;                /* First page, or null. */
+    size_t cnt;                 /* Number of pages. */
+  };
+
+static struct slot slots[SLOT_CNT];
+
+static void mark (struct slot *, bool check);
+
+void
+test_palloc_bench (void) 
+{
+  int i, fails;
+  void *probe;
+
+  msg ("Running %d random allocations and frees...", OP_CNT);
+  random_init (0);
+  fails = 0;
+  for (i = 0; i < SLOT_CNT; i++)
+    slots[i].pages = NULL;
+  for (i = 0; i < OP_CNT; i++) 
+    {
+      struct slot *s = &slots[random_ulong () % SLOT_CNT];
+      size_t cnt = random_ulong () % MAX_PAGES + 1;
+
+      if (s->pages != NULL) 
+        {
+          mark (s, true);
+          palloc_free_multiple (s->pages, s->cnt);
+          s->pages = NULL;
+        }
+      else 
+        {
+          s->pages = palloc_get_multiple (PAL_USER, cnt);
+          s->cnt = cnt;
+          if (s->pages == NULL)
+            fails++;
+          else
+            mark (s, false);
+        }
+    }
+  probe = palloc_get_multiple (PAL_USER, PROBE_PAGES);
+  palloc_free_multiple (probe, PROBE_PAGES);
+  for (i = 0; i < SLOT_CNT; i++) 
+    {
+      if (slots[i].pages != NULL)
+        mark (&slots[i], true);
+      palloc_free_multiple (slots[i].pages, slots[i].cnt);
+    }
+  if (fails > 0)
+    fail ("buddy allocator failed %d allocations", fails);
+  if (probe == NULL)
+    fail ("buddy allocator found no %d-page run", PROBE_PAGES);
+  msg ("Found a %d-page run with the last runs still live.", PROBE_PAGES);
+  pass ();
+}
+
+/* Writes slot S's index into each of its pages or, if CHECK,
+   checks that each still holds it, which fails if some other
+   allocation was handed one of them. */
+static void
+mark (struct slot *s, bool check) 
+{
+  uint8_t tag = s - slots;
+  size_t i;
+
+  for (i = 0; i < s->cnt; i++) 
+    {
+      uint8_t *page = (uint8_t *) s->pages + i * PGSIZE;
+
+      if (!check)
+        *page = tag;
+      else if (*page != tag)
+        fail ("page %zu of slot %d was handed out twice", i, tag);
+    }
+}
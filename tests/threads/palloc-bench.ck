@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(palloc-bench) begin
+(palloc-bench) Running 20000 random allocations and frees...
+(palloc-bench) Found a 64-page run with the last runs still live.
+(palloc-bench) PASS
+(palloc-bench) end
+EOF
+pass;
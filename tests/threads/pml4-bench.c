@@ -0,0 +1,72 @@
+/* Runs the page-table work of a fork/exit loop: each iteration
+   creates a page map, maps MAP_PAGES user pages in it, split
+   between a code-like region and a stack-like region as a small
+   process would have, and destroys it again.  The loop runs
+   first with the page-table page cache emptied before every
+   iteration, as if there were no cache, then with the cache.
+   Nothing is freed to the cache within an iteration, so the first
+   loop must never hit it, and the second loop must. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/mmu.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+#define ITER_CNT 200
+#define MAP_PAGES 32
+
+static void fork_exit_loop (bool shrink);
+
+void
+test_pml4_bench (void) 
+{
+  long long hits;
+
+  hits = pml4_cache_hit_cnt ();
+  fork_exit_loop (true);
+  hits = pml4_cache_hit_cnt () - hits;
+  if (hits != 0)
+    fail ("emptied page-table page cache was hit %lld times", hits);
+  msg ("Without the cache, no page-table page was reused.");
+
+  hits = pml4_cache_hit_cnt ();
+  fork_exit_loop (false);
+  hits = pml4_cache_hit_cnt () - hits;
+  if (hits <= 0)
+    fail ("page-table page cache was never hit");
+  msg ("With the cache, page-table pages were reused.");
+  pass ();
+}
+
+/* Runs ITER_CNT create/map/destroy iterations.  If SHRINK,
+   empties the page-table page cache before each iteration. */
+static void
+fork_exit_loop (bool shrink) 
+{
+  int i, j;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      uint64_t *pml4;
+
+      if (shrink)
+        pml4_cache_shrink (SIZE_MAX);
+
+      pml4 = pml4_create ();
+      if (pml4 == NULL)
+        fail ("pml4_create failed");
+      for (j = 0; j < MAP_PAGES; j++) 
+        {
+          uint8_t *upage = j < MAP_PAGES / 2
+                           ? (uint8_t *) 0x400000 + PGSIZE * j
+                           : (uint8_t *) USER_STACK - PGSIZE * (MAP_PAGES - j);
+          void *kpage = palloc_get_page (PAL_USER);
+
+          if (kpage == NULL || !pml4_set_page (pml4, upage, kpage, true))
+            fail ("mapping page %d failed", j);
+        }
+      pml4_destroy (pml4);
+    }
+}
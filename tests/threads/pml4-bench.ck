@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(pml4-bench) begin
+(pml4-bench) Without the cache, no page-table page was reused.
+(pml4-bench) With the cache, page-table pages were reused.
+(pml4-bench) PASS
+(pml4-bench) end
+EOF
+pass;
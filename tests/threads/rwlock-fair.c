@@ -0,0 +1,142 @@
+/* Checks that a reader-writer lock is fair to writers and
+   excludes them.
+
+   The main thread acquires the lock for reading.  A writer then
+   arrives and waits for the main thread to leave.  A reader that
+   arrives after the writer, at a higher priority still, must
+   queue behind it instead of joining the main thread.
+
+   Then readers and writers at the same priority take turns,
+   yielding inside their critical sections, and no writer may
+   ever be inside alongside anyone else. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define READER_CNT 4
+#define WRITER_CNT 2
+#define ITER_CNT 10
+
+/* State shared by the test and its threads. */
+struct rwlock_test 
+  {
+    struct rwlock rw;
+    struct semaphore done;
+    bool written;                       /* Late writer has written? */
+    int readers;                        /* Readers inside. */
+    int writers;                        /* Writers inside. */
+    int value;                          /* Incremented by writers. */
+  };
+
+static thread_func late_writer_func;
+static thread_func late_reader_func;
+static thread_func reader_func;
+static thread_func writer_func;
+
+void
+test_rwlock_fair (void) 
+{
+  struct rwlock_test t;
+  int i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  rwlock_init (&t.rw);
+  sema_init (&t.done, 0);
+  t.written = false;
+  t.readers = t.writers = t.value = 0;
+
+  rwlock_read_acquire (&t.rw);
+  thread_create ("writer", PRI_DEFAULT + 1, late_writer_func, &t);
+  thread_create ("reader", PRI_DEFAULT + 2, late_reader_func, &t);
+  msg ("main: releasing the read lock.");
+  rwlock_read_release (&t.rw);
+  msg ("main: writer and reader must have finished.");
+
+  for (i = 0; i < READER_CNT; i++)
+    thread_create ("reader", PRI_DEFAULT, reader_func, &t);
+  for (i = 0; i < WRITER_CNT; i++)
+    thread_create ("writer", PRI_DEFAULT, writer_func, &t);
+  for (i = 0; i < READER_CNT + WRITER_CNT; i++)
+    sema_down (&t.done);
+  if (t.value != WRITER_CNT * ITER_CNT)
+    fail ("writers wrote %d times, expected %d",
+          t.value, WRITER_CNT * ITER_CNT);
+  msg ("main: no writer ever overlapped another thread.");
+}
+
+/* Waits for the main thread to stop reading, then writes. */
+static void
+late_writer_func (void *t_) 
+{
+  struct rwlock_test *t = t_;
+
+  rwlock_write_acquire (&t->rw);
+  msg ("writer: got the lock");
+  t->written = true;
+  rwlock_write_release (&t->rw);
+  msg ("writer: done");
+}
+
+/* Arrives while the late writer waits, and must not get in
+   before it. */
+static void
+late_reader_func (void *t_) 
+{
+  struct rwlock_test *t = t_;
+
+  rwlock_read_acquire (&t->rw);
+  if (!t->written)
+    fail ("reader got in ahead of the waiting writer");
+  msg ("reader: got the lock");
+  rwlock_read_release (&t->rw);
+}
+
+static void
+reader_func (void *t_) 
+{
+  struct rwlock_test *t = t_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      rwlock_read_acquire (&t->rw);
+      t->readers++;
+      if (t->writers != 0)
+        fail ("reader inside with a writer");
+      thread_yield ();
+      if (t->writers != 0)
+        fail ("writer entered while a reader was inside");
+      t->readers--;
+      rwlock_read_release (&t->rw);
+      thread_yield ();
+    }
+  sema_up (&t->done);
+}
+
+static void
+writer_func (void *t_) 
+{
+  struct rwlock_test *t = t_;
+  int i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      rwlock_write_acquire (&t->rw);
+      t->writers++;
+      if (t->writers != 1 || t->readers != 0)
+        fail ("writer inside with another thread");
+      thread_yield ();
+      t->value++;
+      if (t->writers != 1 || t->readers != 0)
+        fail ("thread entered while a writer was inside");
+      t->writers--;
+      rwlock_write_release (&t->rw);
+      thread_yield ();
+    }
+  sema_up (&t->done);
+}
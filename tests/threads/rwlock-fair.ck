@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(rwlock-fair) begin
+(rwlock-fair) main: releasing the read lock.
+(rwlock-fair) writer: got the lock
+(rwlock-fair) reader: got the lock
+(rwlock-fair) writer: done
+(rwlock-fair) main: writer and reader must have finished.
+(rwlock-fair) main: no writer ever overlapped another thread.
+(rwlock-fair) end
+EOF
+pass;
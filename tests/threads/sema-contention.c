@@ -0,0 +1,87 @@
+/* Exercises wakeups from a semaphore with many waiters.  Blocks
+   WAITER_CNT threads of assorted priorities on one semaphore,
+   then ups it once per waiter and checks that they woke highest
+   priority first, and first-come, first-served among equals.
+   Repeats this ROUND_CNT times. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define WAITER_CNT 200
+#define ROUND_CNT 5
+
+struct waiter
+  {
+    struct semaphore *sema;     /* Semaphore to wait on. */
+    int id;                     /* Creation order. */
+    int priority;               /* Priority it was created with. */
+  };
+
+static struct waiter waiters[WAITER_CNT];
+static struct waiter *woken[WAITER_CNT];
+static int woken_cnt;
+
+static thread_func waiter_thread;
+
+void
+test_sema_contention (void) 
+{
+  struct semaphore sema;
+  int round, i;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  msg ("Waking %d waiters, %d times...", WAITER_CNT, ROUND_CNT);
+  for (round = 0; round < ROUND_CNT; round++) 
+    {
+      sema_init (&sema, 0);
+      woken_cnt = 0;
+      for (i = 0; i < WAITER_CNT; i++) 
+        {
+          struct waiter *w = &waiters[i];
+
+          w->sema = &sema;
+          w->id = i;
+          w->priority = PRI_MIN + 1 + (i * 7) % (PRI_DEFAULT - PRI_MIN - 1);
+          if (thread_create ("waiter", w->priority, waiter_thread, w)
+              == TID_ERROR)
+            fail ("thread_create failed after %d threads", i);
+        }
+
+      /* Let every waiter block, then wake them one at a time.
+         Each preempts us as soon as it is woken. */
+      thread_set_priority (PRI_MIN);
+      for (i = 0; i < WAITER_CNT; i++)
+        sema_up (&sema);
+      thread_set_priority (PRI_DEFAULT);
+
+      if (woken_cnt != WAITER_CNT)
+        fail ("%d of %d waiters woke", woken_cnt, WAITER_CNT);
+      for (i = 1; i < WAITER_CNT; i++) 
+        {
+          struct waiter *a = woken[i - 1], *b = woken[i];
+
+          if (a->priority < b->priority
+              || (a->priority == b->priority && a->id > b->id))
+            fail ("waiter %d (priority %d) woke before "
+                  "waiter %d (priority %d)",
+                  a->id, a->priority, b->id, b->priority);
+        }
+    }
+  msg ("Waiters woke in priority order, first-come, first-served "
+       "among equals.");
+  pass ();
+}
+
+static void
+waiter_thread (void *w_) 
+{
+  struct waiter *w = w_;
+
+  sema_down (w->sema);
+  woken[woken_cnt++] = w;
+}
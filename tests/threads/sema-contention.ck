@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sema-contention) begin
+(sema-contention) Waking 200 waiters, 5 times...
+(sema-contention) Waiters woke in priority order, first-come, first-served among equals.
+(sema-contention) PASS
+(sema-contention) end
+EOF
+pass;
@@ -0,0 +1,120 @@
+/* Checks that a sequence lock reader retries a read that a
+   writer overlapped, and never accepts a torn copy.
+
+   The record is a pair whose second member is always twice the
+   first.  First the main thread begins a read, copies one member,
+   and wakes a higher-priority writer, which preempts it and
+   updates the record before the copy is finished.  Then a writer
+   updates the record on every other timer tick while the main
+   thread reads it with a copy that always spans a tick, so that
+   the writer preempts it in the middle of most reads. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define WRITE_CNT 20
+
+/* The record and its sequence lock. */
+struct record 
+  {
+    int a, b;                   /* b == 2 * a. */
+  };
+static struct record rec;
+static struct seqlock sl;
+
+static struct semaphore go;
+static volatile bool writer_done;
+
+static thread_func wake_writer_func;
+static thread_func tick_writer_func;
+static void write_record (void);
+
+void
+test_seqlock_retry (void) 
+{
+  struct record copy;
+  unsigned seq;
+  int retries;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  seqlock_init (&sl);
+  sema_init (&go, 0);
+  thread_create ("writer", PRI_DEFAULT + 1, wake_writer_func, NULL);
+
+  seq = seqlock_read_begin (&sl);
+  copy.a = rec.a;
+  sema_up (&go);
+  copy.b = rec.b;
+  if (!seqlock_read_retry (&sl, seq))
+    fail ("read overlapped by a write was not retried");
+  msg ("read overlapped by a write must be retried.");
+
+  seq = seqlock_read_begin (&sl);
+  copy = rec;
+  if (seqlock_read_retry (&sl, seq))
+    fail ("read with no write was retried");
+  if (copy.b != 2 * copy.a)
+    fail ("read %d and %d", copy.a, copy.b);
+  msg ("read with no write must not be retried.");
+
+  writer_done = false;
+  thread_create ("writer", PRI_DEFAULT + 1, tick_writer_func, NULL);
+  retries = 0;
+  do 
+    {
+      int64_t start;
+
+      seq = seqlock_read_begin (&sl);
+      copy.a = rec.a;
+      start = timer_ticks ();
+      while (timer_ticks () == start)
+        barrier ();
+      copy.b = rec.b;
+      if (seqlock_read_retry (&sl, seq))
+        retries++;
+      else if (copy.b != 2 * copy.a)
+        fail ("accepted a torn read of %d and %d", copy.a, copy.b);
+    }
+  while (!writer_done);
+  if (retries == 0)
+    fail ("writer never overlapped a read");
+  msg ("reader must never accept a torn read.");
+}
+
+/* Writes once when the main thread ups GO. */
+static void
+wake_writer_func (void *aux UNUSED) 
+{
+  sema_down (&go);
+  write_record ();
+}
+
+/* Writes WRITE_CNT times, one timer tick apart. */
+static void
+tick_writer_func (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < WRITE_CNT; i++) 
+    {
+      timer_sleep (1);
+      write_record ();
+    }
+  writer_done = true;
+}
+
+/* Updates the record under the sequence lock. */
+static void
+write_record (void) 
+{
+  seqlock_write_begin (&sl);
+  rec.a++;
+  rec.b = 2 * rec.a;
+  seqlock_write_end (&sl);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(seqlock-retry) begin
+(seqlock-retry) read overlapped by a write must be retried.
+(seqlock-retry) read with no write must not be retried.
+(seqlock-retry) reader must never accept a torn read.
+(seqlock-retry) end
+EOF
+pass;
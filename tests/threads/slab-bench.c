@@ -0,0 +1,51 @@
+/* Allocates and frees OBJ_CNT objects of OBJ_SIZE bytes, first
+   from an object cache and then with malloc(), and compares the
+   pages each held with all the objects live.  OBJ_SIZE is just over a power of 2, which malloc()
+   rounds up to its next size class.  The cache must hold no more
+   pages than malloc(), and must be down to its one spare slab
+   once the objects are freed. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/malloc.h"
+#include "threads/slab.h"
+
+#define OBJ_SIZE 136
+#define OBJ_CNT 1000
+
+static void *objs[OBJ_CNT];
+
+void
+test_slab_bench (void) 
+{
+  struct kmem_cache *c;
+  size_t cache_pages, malloc_pages, base_pages;
+  int i;
+
+  c = kmem_cache_create ("slab-bench", OBJ_SIZE, NULL, NULL);
+  if (c == NULL)
+    fail ("kmem_cache_create failed");
+
+  for (i = 0; i < OBJ_CNT; i++) 
+    if ((objs[i] = kmem_cache_alloc (c)) == NULL)
+      fail ("kmem_cache_alloc failed");
+  cache_pages = kmem_cache_page_cnt (c);
+  for (i = 0; i < OBJ_CNT; i++)
+    kmem_cache_free (c, objs[i]);
+  if (kmem_cache_page_cnt (c) > 1)
+    fail ("cache holds %zu pages after freeing every object",
+          kmem_cache_page_cnt (c));
+
+  base_pages = malloc_page_cnt ();
+  for (i = 0; i < OBJ_CNT; i++) 
+    if ((objs[i] = malloc (OBJ_SIZE)) == NULL)
+      fail ("malloc failed");
+  malloc_pages = malloc_page_cnt () - base_pages;
+  for (i = 0; i < OBJ_CNT; i++)
+    free (objs[i]);
+  if (cache_pages > malloc_pages)
+    fail ("cache used %zu pages, more than malloc's %zu",
+          cache_pages, malloc_pages);
+  msg ("Cache held no more pages than malloc().");
+  pass ();
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(slab-bench) begin
+(slab-bench) Cache held no more pages than malloc().
+(slab-bench) PASS
+(slab-bench) end
+EOF
+pass;
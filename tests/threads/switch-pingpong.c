@@ -0,0 +1,209 @@
+/* Exercises context switches.  Two threads at the same priority
+   hand control back and forth through a pair of semaphores, so
+   that every sema_up() is followed by a switch.
+
+   It then times the switch itself, without the scheduler, both
+   ways: through switch_context(), which saves only the
+   callee-saved registers, and the way thread_launch() used to
+   switch, by saving every register in an intr_frame and
+   resuming the other side with do_iret().  The first must be the
+   cheaper. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "tests/threads/tests.h"
+#include "threads/flags.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/switch.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "intrinsic.h"
+
+#define ROUND_CNT 100000
+#define SWITCH_CNT 100000
+
+static thread_func pong_thread;
+static struct semaphore ping, pong, done;
+
+static uint64_t time_switch_context (void);
+static uint64_t time_iret (void);
+
+void
+test_switch_pingpong (void) 
+{
+  uint64_t callee_saved, iret;
+  int i;
+
+  sema_init (&ping, 0);
+  sema_init (&pong, 0);
+  sema_init (&done, 0);
+  thread_create ("pong", PRI_DEFAULT, pong_thread, NULL);
+
+  msg ("Ping-ponging %d rounds...", ROUND_CNT);
+  for (i = 0; i < ROUND_CNT; i++) 
+    {
+      sema_up (&ping);
+      sema_down (&pong);
+    }
+  sema_down (&done);
+
+  msg ("Timing switch_context against do_iret...");
+  callee_saved = time_switch_context ();
+  iret = time_iret ();
+  if (callee_saved >= iret)
+    fail ("switch_context took %"PRIu64" cycles per switch, "
+          "no faster than do_iret's %"PRIu64, callee_saved, iret);
+  pass ();
+}
+
+static void
+pong_thread (void *aux UNUSED) 
+{
+  int i;
+
+  for (i = 0; i < ROUND_CNT; i++) 
+    {
+      sema_down (&ping);
+      sema_up (&pong);
+    }
+  sema_up (&done);
+}
+
+/* Saved stack pointers of the test and of its partner, for
+   switch_context(). */
+static uint64_t main_rsp, partner_rsp;
+
+/* Saved contexts of the test and of its partner, for
+   iret_switch(). */
+static struct intr_frame main_tf, partner_tf;
+
+/* Switches straight back to the test, forever. */
+static void
+switch_partner (void) 
+{
+  for (;;)
+    switch_context (&partner_rsp, main_rsp);
+}
+
+/* Returns the average cycles of a switch_context() to a partner
+   on its own stack and back. */
+static uint64_t
+time_switch_context (void) 
+{
+  uint8_t *stack = palloc_get_page (PAL_ASSERT);
+  struct switch_frame *sf;
+  enum intr_level old_level;
+  uint64_t start, cycles;
+  int i;
+
+  /* Leave the partner's stack aligned as if switch_partner() had
+     been called. */
+  sf = (struct switch_frame *) (stack + PGSIZE - sizeof (void *)) - 1;
+  memset (sf, 0, sizeof *sf);
+  sf->rip = switch_partner;
+  partner_rsp = (uint64_t) sf;
+
+  old_level = intr_disable ();
+  start = rdtsc ();
+  for (i = 0; i < SWITCH_CNT; i++)
+    switch_context (&main_rsp, partner_rsp);
+  cycles = rdtsc () - start;
+  intr_set_level (old_level);
+
+  palloc_free_page (stack);
+  return cycles / (2 * SWITCH_CNT);
+}
+
+/* Saves every register in CUR and resumes NEXT with do_iret(),
+   as thread_launch() used to.  Returns when CUR is resumed. */
+static void __attribute__ ((noinline))
+iret_switch (struct intr_frame *cur, struct intr_frame *next) 
+{
+  __asm __volatile (
+      "push %%rax\n"
+      "push %%rbx\n"
+      "push %%rcx\n"
+      "movq %0, %%rax\n"
+      "movq %1, %%rcx\n"
+      "movq %%r15, 0(%%rax)\n"
+      "movq %%r14, 8(%%rax)\n"
+      "movq %%r13, 16(%%rax)\n"
+      "movq %%r12, 24(%%rax)\n"
+      "movq %%r11, 32(%%rax)\n"
+      "movq %%r10, 40(%%rax)\n"
+      "movq %%r9, 48(%%rax)\n"
+      "movq %%r8, 56(%%rax)\n"
+      "movq %%rsi, 64(%%rax)\n"
+      "movq %%rdi, 72(%%rax)\n"
+      "movq %%rbp, 80(%%rax)\n"
+      "movq %%rdx, 88(%%rax)\n"
+      "pop %%rbx\n"
+      "movq %%rbx, 96(%%rax)\n"
+      "pop %%rbx\n"
+      "movq %%rbx, 104(%%rax)\n"
+      "pop %%rbx\n"
+      "movq %%rbx, 112(%%rax)\n"
+      "addq $120, %%rax\n"
+      "movw %%es, (%%rax)\n"
+      "movw %%ds, 8(%%rax)\n"
+      "addq $32, %%rax\n"
+      "call 1f\n"
+      "1:\n"
+      "pop %%rbx\n"
+      "addq $(2f - 1b), %%rbx\n"
+      "movq %%rbx, 0(%%rax)\n"
+      "movw %%cs, 8(%%rax)\n"
+      "pushfq\n"
+      "popq %%rbx\n"
+      "mov %%rbx, 16(%%rax)\n"
+      "mov %%rsp, 24(%%rax)\n"
+      "movw %%ss, 32(%%rax)\n"
+      "mov %%rcx, %%rdi\n"
+      "call do_iret\n"
+      "2:\n"
+      : : "D" (cur), "S" (next) : "memory");
+}
+
+/* Switches straight back to the test through do_iret(),
+   forever. */
+static void
+iret_partner (void) 
+{
+  for (;;)
+    iret_switch (&partner_tf, &main_tf);
+}
+
+/* Returns the average cycles of an iret_switch() to a partner on
+   its own stack and back. */
+static uint64_t
+time_iret (void) 
+{
+  uint8_t *stack = palloc_get_page (PAL_ASSERT);
+  enum intr_level old_level;
+  uint64_t start, cycles;
+  int i;
+
+  memset (&partner_tf, 0, sizeof partner_tf);
+  partner_tf.rip = (uintptr_t) iret_partner;
+  partner_tf.ds = SEL_KDSEG;
+  partner_tf.es = SEL_KDSEG;
+  partner_tf.ss = SEL_KDSEG;
+  partner_tf.cs = SEL_KCSEG;
+  partner_tf.eflags = FLAG_MBS;
+  partner_tf.rsp = (uintptr_t) stack + PGSIZE - sizeof (void *);
+
+  old_level = intr_disable ();
+  start = rdtsc ();
+  for (i = 0; i < SWITCH_CNT; i++)
+    iret_switch (&main_tf, &partner_tf);
+  cycles = rdtsc () - start;
+  intr_set_level (old_level);
+
+  palloc_free_page (stack);
+  return cycles / (2 * SWITCH_CNT);
+}
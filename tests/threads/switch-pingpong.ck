@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(switch-pingpong) begin
+(switch-pingpong) Ping-ponging 100000 rounds...
+(switch-pingpong) Timing switch_context against do_iret...
+(switch-pingpong) PASS
+(switch-pingpong) end
+EOF
+pass;
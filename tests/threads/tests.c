@@ -29,6 +29,19 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"fair-share", test_fair_share},
+    {"edf-inherit", test_edf_inherit},
+    {"rwlock-donate", test_rwlock_donate},
+    {"rwlock-fair", test_rwlock_fair},
+    {"seqlock-retry", test_seqlock_retry},
+    {"thread-create", test_thread_create},
+    {"switch-pingpong", test_switch_pingpong},
+    {"sema-contention", test_sema_contention},
+    {"palloc-bench", test_palloc_bench},
+    {"malloc-bench", test_malloc_bench},
+    {"pml4-bench", test_pml4_bench},
+    {"bitmap-bench", test_bitmap_bench},
+    {"slab-bench", test_slab_bench},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -23,6 +23,19 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_fair_share;
+extern test_func test_edf_inherit;
+extern test_func test_rwlock_donate;
+extern test_func test_rwlock_fair;
+extern test_func test_seqlock_retry;
+extern test_func test_thread_create;
+extern test_func test_switch_pingpong;
+extern test_func test_sema_contention;
+extern test_func test_palloc_bench;
+extern test_func test_malloc_bench;
+extern test_func test_pml4_bench;
+extern test_func test_bitmap_bench;
+extern test_func test_slab_bench;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -0,0 +1,70 @@
+/* Exercises thread creation and teardown.  Creates and joins
+   THREAD_CNT short-lived threads, one at a time.  Every thread
+   after the first can reuse the page of one that has already
+   exited, so the threads must run on no more than MAX_PAGES
+   distinct pages, and each must get a greater tid than the one
+   before. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+#define THREAD_CNT 2000
+
+/* Most distinct pages the threads may run on.  The thread page
+   cache holds up to 16. */
+#define MAX_PAGES 16
+
+static thread_func exit_thread;
+
+/* Distinct pages the threads ran on. */
+static void *pages[MAX_PAGES];
+static int page_cnt;
+
+void
+test_thread_create (void) 
+{
+  struct semaphore done;
+  tid_t tid, last_tid = TID_ERROR;
+  int i;
+
+  sema_init (&done, 0);
+
+  msg ("Creating and joining %d threads...", THREAD_CNT);
+  for (i = 0; i < THREAD_CNT; i++) 
+    {
+      tid = thread_create ("churn", PRI_DEFAULT, exit_thread, &done);
+      if (tid == TID_ERROR)
+        fail ("thread_create failed after %d threads", i);
+      if (tid <= last_tid)
+        fail ("tid %d came after tid %d", tid, last_tid);
+      last_tid = tid;
+      sema_down (&done);
+    }
+  if (page_cnt > MAX_PAGES)
+    fail ("threads ran on %d distinct pages, more than %d",
+          page_cnt, MAX_PAGES);
+  msg ("Threads ran on no more than %d distinct pages.", MAX_PAGES);
+  pass ();
+}
+
+static void
+exit_thread (void *done_) 
+{
+  struct semaphore *done = done_;
+  void *page = thread_current ();
+  int i;
+
+  for (i = 0; i < page_cnt && i < MAX_PAGES; i++)
+    if (pages[i] == page)
+      break;
+  if (i == page_cnt) 
+    {
+      if (page_cnt < MAX_PAGES)
+        pages[page_cnt] = page;
+      page_cnt++;
+    }
+  sema_up (done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(thread-create) begin
+(thread-create) Creating and joining 2000 threads...
+(thread-create) Threads ran on no more than 16 distinct pages.
+(thread-create) PASS
+(thread-create) end
+EOF
+pass;
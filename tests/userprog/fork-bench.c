@@ -0,0 +1,75 @@
+/* Times fork-then-exec from a process with a large buffer, then
+   measures how deep a chain of forked processes, each writing one
+   page of that buffer, can grow.  With copy-on-write fork neither
+   grows with the size of the buffer: fork shares its pages, and
+   only the page each process writes is copied.  The kernel's
+   "Fork:" statistics line counts the pages shared and copied. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define BUF_PAGES 256
+#define ITER_CNT 20
+#define CHAIN_MAX 32
+
+static char buf[BUF_PAGES * PAGE_SIZE];
+
+static uint64_t
+rdtsc (void) 
+{
+  uint32_t lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+/* Writes page DEPTH of the buffer and forks the next process of
+   the chain, up to CHAIN_MAX.  Returns the depth the chain
+   reached. */
+static int
+chain (int depth) 
+{
+  pid_t pid;
+  int status;
+
+  buf[depth * PAGE_SIZE] = depth;
+  if (depth == CHAIN_MAX)
+    return depth;
+
+  pid = fork ("chain");
+  if (pid == 0)
+    exit (chain (depth + 1));
+  status = wait (pid);
+  return status < 0 ? depth : status;
+}
+
+void
+test_main (void) 
+{
+  uint64_t total = 0;
+  int i;
+
+  for (i = 0; i < BUF_PAGES; i++)
+    buf[i * PAGE_SIZE] = i;
+
+  for (i = 0; i < ITER_CNT; i++) 
+    {
+      uint64_t start = rdtsc ();
+      pid_t pid = fork ("child");
+
+      if (pid == 0) 
+        {
+          exec ("child-simple");
+          exit (-1);
+        }
+      if (wait (pid) != 81)
+        fail ("child-simple did not run");
+      total += rdtsc () - start;
+    }
+  msg ("fork-then-exec: %llu cycles per iteration.", total / ITER_CNT);
+
+  msg ("chain reached depth %d of %d.", chain (0), CHAIN_MAX);
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+
+common_checks ("run", @output);
+
+# The kernel's statistics must show the buffer in large pages.
+my ($large) = map (/^Large pages: (\d+) mapped/, @output);
+fail "no large pages were mapped"
+  unless defined ($large) && $large > 0;
+
+# The cycle counts, compared with tlb-bench's, are for reading
+# only: they come from separate boots, and under emulation 2 MB
+# guest pages may make no difference at all.
+fail "missing cycle count in output"
+  unless grep (/^\(tlb-bench-large\) \d+ cycles per access\.$/, @output);
+
+@output = get_core_output ("run", @output);
+fail "missing end in output"
+  unless grep ($_ eq '(tlb-bench-large) end', @output);
+
+pass;
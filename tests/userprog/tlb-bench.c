@@ -0,0 +1,48 @@
+/* Touches one byte in every page of a 6 MB zeroed buffer, pass
+   after pass, so that nearly every access needs a fresh TLB
+   entry with 4 kB pages, and reports the cycles each access took.
+   The same program runs as tlb-bench-large with "-large-pages",
+   which maps the buffer's aligned 2 MB runs with single large
+   pages, for comparing the two reports by eye. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define BUF_PAGES (6 * 256)
+#define PASS_CNT 64
+
+static char buf[BUF_PAGES * PAGE_SIZE];
+
+static uint64_t
+rdtsc (void) 
+{
+  uint32_t lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+void
+test_main (void) 
+{
+  uint64_t start, cycles;
+  int i, pass;
+
+  for (i = 0; i < BUF_PAGES; i++)
+    if (buf[i * PAGE_SIZE] != 0)
+      fail ("page %d is not zeroed", i);
+
+  start = rdtsc ();
+  for (pass = 0; pass < PASS_CNT; pass++)
+    for (i = 0; i < BUF_PAGES; i++)
+      buf[i * PAGE_SIZE]++;
+  cycles = rdtsc () - start;
+
+  for (i = 0; i < BUF_PAGES; i++)
+    if (buf[i * PAGE_SIZE] != PASS_CNT)
+      fail ("page %d holds %d, expected %d", i, buf[i * PAGE_SIZE], PASS_CNT);
+  msg ("%llu cycles per access.", cycles / (PASS_CNT * BUF_PAGES));
+}
@@ -0,0 +1,129 @@
+#include "threads/heapstat.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+
+#ifdef HEAPSTAT
+/* Kernel heap accounting.
+
+   Every page or malloc() block is charged to the address of the
+   code that allocated it, its "site".  Sites are kept in a small
+   open-addressed table, so that a tag fits in a byte that the
+   allocators store with each allocation and pass back on free.
+   Tags 0 and 1 collect the palloc and malloc sites that did not
+   fit in the table.
+
+   The printed sites are return addresses; "backtrace kernel.o"
+   turns them into function names and lines. */
+
+#define TAG_CNT 256
+
+/* Allocations charged to one site. */
+struct heap_tag {
+	const void *site;           /* Allocation site, or null. */
+	enum heapstat_kind kind;    /* What the site allocates. */
+	size_t live;                /* Bytes allocated and not freed. */
+	size_t peak;                /* Most bytes ever live. */
+	unsigned long long allocs;  /* Number of allocations. */
+};
+
+static struct heap_tag tags[TAG_CNT] = {
+	[HEAPSTAT_MALLOC] = { .kind = HEAPSTAT_MALLOC },
+};
+
+/* First tag for a site. */
+#define FIRST_SITE_TAG 2
+
+/* Live and peak bytes of each kind. */
+static size_t kind_live[2], kind_peak[2];
+
+/* Charges BYTES of kind KIND to SITE, and returns the tag to pass
+   to heapstat_free() when they are freed. */
+uint8_t
+heapstat_alloc (enum heapstat_kind kind, const void *site, size_t bytes) {
+	size_t site_cnt = TAG_CNT - FIRST_SITE_TAG;
+	size_t start = ((uintptr_t) site >> 2) * 2654435761u % site_cnt;
+	size_t i = start;
+	enum intr_level old_level;
+	struct heap_tag *t;
+
+	old_level = intr_disable ();
+	do {
+		t = &tags[FIRST_SITE_TAG + i];
+		if (t->site == site || t->site == NULL)
+			break;
+		i = (i + 1) % site_cnt;
+	} while (i != start);
+	if (t->site != site && t->site != NULL)
+		t = &tags[kind];
+	else if (t->site == NULL) {
+		t->site = site;
+		t->kind = kind;
+	}
+
+	t->allocs++;
+	t->live += bytes;
+	if (t->live > t->peak)
+		t->peak = t->live;
+	kind_live[kind] += bytes;
+	if (kind_live[kind] > kind_peak[kind])
+		kind_peak[kind] = kind_live[kind];
+	intr_set_level (old_level);
+
+	return t - tags;
+}
+
+/* Releases BYTES charged to TAG. */
+void
+heapstat_free (uint8_t tag, size_t bytes) {
+	struct heap_tag *t = &tags[tag];
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	ASSERT (t->live >= bytes);
+	t->live -= bytes;
+	kind_live[t->kind] -= bytes;
+	intr_set_level (old_level);
+}
+
+/* Prints live and peak bytes for each kind of allocation and for
+   each allocation site.  Sites that still hold memory at
+   shutdown are possible leaks. */
+void
+heapstat_print (void) {
+	static const char *kind_names[] = { "palloc", "malloc" };
+	size_t i;
+
+	printf ("Heap: palloc %zu bytes live, %zu peak; "
+			"malloc %zu bytes live, %zu peak\n",
+			kind_live[HEAPSTAT_PAGES], kind_peak[HEAPSTAT_PAGES],
+			kind_live[HEAPSTAT_MALLOC], kind_peak[HEAPSTAT_MALLOC]);
+	printf ("Heap sites: kind, site, live, peak, allocations\n");
+	for (i = 0; i < TAG_CNT; i++) {
+		struct heap_tag *t = &tags[i];
+
+		if (t->allocs == 0)
+			continue;
+		if (i < FIRST_SITE_TAG)
+			printf ("%s other: ", kind_names[t->kind]);
+		else
+			printf ("%s %p: ", kind_names[t->kind], t->site);
+		printf ("%zu, %zu, %llu\n", t->live, t->peak, t->allocs);
+	}
+	malloc_print_stats ();
+}
+
+/* Prints heap statistics for int 0x45. */
+static void
+heapstat_intr (struct intr_frame *f UNUSED) {
+	heapstat_print ();
+}
+
+/* Lets user programs print heap statistics at any time via
+   int 0x45. */
+void
+heapstat_init_intr (void) {
+	intr_register_int (0x45, 3, INTR_OFF, heapstat_intr, "Heap Statistics");
+}
+#endif /* HEAPSTAT */
@@ -13,6 +13,7 @@
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "devices/vga.h"
+#include "threads/heapstat.h"
 #include "threads/interrupt.h"
 #include "threads/io.h"
 #include "threads/loader.h"
@@ -20,6 +21,7 @@
 #include "threads/mmu.h"
 #include "threads/palloc.h"
 #include "threads/pte.h"
+#include "threads/slab.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/process.h"
@@ -100,6 +102,9 @@ main (void) {
 #ifdef USERPROG
 	exception_init ();
 	syscall_init ();
+#endif
+#ifdef HEAPSTAT
+	heapstat_init_intr ();
 #endif
 	/* Start thread scheduler and enable interrupts. */
 	thread_start ();
@@ -152,9 +157,21 @@ paging_init (uint64_t mem_end) {
 	extern char start, _end_kernel_text;
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
+	// Uses 2 MB pages, which save page tables and TLB entries,
+	// except where the kernel text, which must be read-only, or
+	// the end of memory falls inside one.
 	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (pa % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (va + LARGE_PGSIZE <= (uint64_t) &start
+					|| va >= (uint64_t) pg_round_up (&_end_kernel_text))) {
+			if ((pte = pml4_pde_walk (pml4, va, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_P | PTE_W;
+			pa += LARGE_PGSIZE - PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
@@ -165,6 +182,9 @@ paging_init (uint64_t mem_end) {
 
 	// reload cr3
 	pml4_activate(0);
+
+	// Let the page allocator take back cached page-table pages.
+	palloc_add_reclaim (0, pml4_cache_shrink);
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,16 +241,27 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-fair"))
+			thread_fair = true;
+		else if (!strcmp (name, "-tickless"))
+			timer_tickless = true;
+		else if (!strcmp (name, "-sched-trace"))
+			thread_trace = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+		else if (!strcmp (name, "-large-pages"))
+			process_large_pages = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
 	}
 
+	if (thread_mlfqs && thread_fair)
+		PANIC ("-mlfqs and -fair are mutually exclusive");
+
 	return argv;
 }
 
@@ -326,8 +357,12 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -fair              Use proportional-share scheduler.\n"
+			"  -tickless          Stop the timer tick while idle.\n"
+			"  -sched-trace       Dump scheduler events as CSV at power off.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+			"  -large-pages       Map large zeroed user regions with 2 MB pages.\n"
 #endif
 			);
 	power_off ();
@@ -354,12 +389,24 @@ static void
 print_stats (void) {
 	timer_print_stats ();
 	thread_print_stats ();
+	palloc_print_stats ();
+	pml4_print_stats ();
+	kmem_print_stats ();
+	if (thread_trace)
+		thread_trace_dump ();
 #ifdef FILESYS
 	disk_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
+#ifdef LOCKSTAT
+	lockstat_print ();
+#endif
+#ifdef HEAPSTAT
+	heapstat_print ();
+#endif
 #ifdef USERPROG
 	exception_print_stats ();
+	process_print_stats ();
 #endif
 }
@@ -5,15 +5,18 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapstat.h"
 #include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* A simple implementation of malloc().
 
-   The size of each request, in bytes, is rounded up to a power
-   of 2 and assigned to the "descriptor" that manages blocks of
-   that size.  The descriptor keeps a list of free blocks.  If
+   The size of each request, in bytes, is rounded up to the next
+   block size, a power of 2 or, from 1 kB up, also 1.5 times a
+   power of 2, and assigned to the "descriptor" that manages
+   blocks of that size.  The descriptor keeps a list of free blocks.  If
    the free list is nonempty, one of its blocks is used to
    satisfy the request.
 
@@ -23,25 +26,62 @@
    into blocks, all of which are added to the descriptor's free
    list.  Then we return one of the new blocks.
 
+   Blocks that would waste more than 1/16 of a one-page arena,
+   such as 1.5 kB blocks, of which only 2 fit in a page, get an
+   arena of up to MAX_ARENA_PAGES contiguous pages instead.  A
+   block there may be pages away from its arena header, so each
+   one is preceded by a header that points to its arena.  These
+   blocks are aligned on 16 bytes, and all others are not, so
+   that free() can tell which kind it has.
+
    When we free a block, we add it to its descriptor's free list.
    But if the arena that the block was in now has no in-use
    blocks, we remove all of the arena's blocks from the free list
    and give the arena back to the page allocator.
 
-   We can't handle blocks bigger than 2 kB using this scheme,
-   because they're too big to fit in a single page with a
-   descriptor.  We handle those by allocating contiguous pages
-   with the page allocator and sticking the allocation size at
-   the beginning of the allocated block's arena header. */
+   Each descriptor's lock would be taken twice for every block
+   allocated and freed, and with priority donation a contended
+   lock is costly.  For blocks of up to 1 kB, each thread instead
+   keeps a "magazine" of up to MAG_SIZE free blocks per size,
+   which only it uses, so allocating from it and freeing to it
+   take no lock.  An empty magazine is refilled, and a full one
+   drained, MAG_BATCH blocks at a time under one acquisition of
+   the lock.  Blocks in magazines still count as in use in their
+   arenas, so an arena is only given back once they are drained;
+   a thread drains its magazines when it exits.
+
+   We don't handle blocks bigger than 6 kB using this scheme.  We
+   handle those, and medium blocks whose multi-page arena can't
+   be allocated, by allocating contiguous pages with the page
+   allocator and sticking the allocation size at the beginning
+   of the allocated block's arena header. */
+
+#ifdef HEAPSTAT
+/* Each block ends in a byte that holds its heapstat tag. */
+#define TAG_BYTES 1
+#define OCCUPANCY_BUCKETS 4
+#else
+#define TAG_BYTES 0
+#endif
 
 /* Descriptor. */
 struct desc {
 	size_t block_size;          /* Size of each element in bytes. */
+	size_t arena_pages;         /* Number of pages in an arena. */
 	size_t blocks_per_arena;    /* Number of blocks in an arena. */
+	size_t arena_cnt;           /* Number of arenas. */
 	struct list free_list;      /* List of free blocks. */
 	struct lock lock;           /* Lock. */
+	char name[32];              /* Lock name, e.g. "malloc-1024". */
+#ifdef HEAPSTAT
+	size_t occupancy[OCCUPANCY_BUCKETS]; /* Arenas, by quarter of
+	                                       blocks in use. */
+#endif
 };
 
+/* Most pages in one arena. */
+#define MAX_ARENA_PAGES 8
+
 /* Magic number for detecting arena corruption. */
 #define ARENA_MAGIC 0x9a548eed
 
@@ -52,78 +92,240 @@ struct arena {
 	size_t free_cnt;            /* Free blocks; pages in big block. */
 };
 
+/* Magic number for detecting block header corruption. */
+#define BLOCK_MAGIC 0x3b10c4ed
+
+/* Header before each block in a multi-page arena. */
+struct block_hdr {
+	struct arena *arena;        /* Owning arena. */
+	unsigned magic;             /* Always set to BLOCK_MAGIC. */
+};
+
+/* Offset of the first block header in a multi-page arena,
+   chosen so that the blocks are aligned on 16 bytes. */
+#define MULTI_OFS ROUND_UP (sizeof (struct arena), 16)
+
 /* Free block. */
 struct block {
-	struct list_elem free_elem; /* Free list element. */
+	union {
+		struct list_elem free_elem; /* Free list element. */
+		struct block *mag_next;     /* Next block in a magazine. */
+	};
 };
 
-/* Our set of descriptors. */
-static struct desc descs[10];   /* Descriptors. */
-static size_t desc_cnt;         /* Number of descriptors. */
+/* Most blocks in a magazine, and the number of blocks moved
+   between a magazine and its descriptor at once. */
+#define MAG_SIZE 8
+#define MAG_BATCH (MAG_SIZE / 2)
+
+/* Block sizes, in bytes. */
+static const size_t block_sizes[] = {
+	16, 32, 64, 128, 256, 512, 1024, 1536, 2048, 3072, 4096, 6144,
+};
 
+/* Our set of descriptors. */
+#define DESC_CNT (sizeof block_sizes / sizeof *block_sizes)
+static struct desc descs[DESC_CNT];   /* Descriptors. */
+
+/* Number of pages in big blocks. */
+static size_t big_pages;
+
+static void desc_init (struct desc *, size_t block_size);
+static void *tagged_malloc (size_t size, const void *site);
+static void *block_get (size_t size);
+static size_t block_size (void *block);
+static void occupancy_move (struct desc *, size_t old_used, size_t new_used);
+static void *big_block (size_t size);
+static struct block *desc_take (struct desc *);
+static void desc_give (struct desc *, struct block *);
+static void mag_push (struct malloc_magazine *, struct block *);
+static struct block *mag_pop (struct malloc_magazine *);
+static void mag_drain (struct desc *, struct malloc_magazine *, size_t cnt);
 static struct arena *block_to_arena (struct block *);
 static struct block *arena_to_block (struct arena *, size_t idx);
 
 /* Initializes the malloc() descriptors. */
 void
 malloc_init (void) {
-	size_t block_size;
+	size_t i;
+
+	/* Blocks in one-page arenas must not be aligned on 16 bytes,
+	   and blocks in multi-page arenas must be. */
+	ASSERT (sizeof (struct arena) % 16 == 8);
+	ASSERT (sizeof (struct block_hdr) == 16);
+	ASSERT (block_sizes[MALLOC_MAG_CLASSES - 1] <= 1024);
+
+	for (i = 0; i < DESC_CNT; i++)
+		desc_init (&descs[i], block_sizes[i]);
+}
 
-	for (block_size = 16; block_size < PGSIZE / 2; block_size *= 2) {
-		struct desc *d = &descs[desc_cnt++];
-		ASSERT (desc_cnt <= sizeof descs / sizeof *descs);
-		d->block_size = block_size;
+/* Initializes descriptor D for blocks of BLOCK_SIZE bytes.  Uses
+   a one-page arena if that wastes at most 1/16 of it, otherwise
+   the smallest multi-page arena that does, otherwise the one
+   that wastes least. */
+static void
+desc_init (struct desc *d, size_t block_size) {
+	size_t pages, best_pages = 0, best_waste = 0;
+
+	ASSERT (block_size % 16 == 0);
+	for (pages = 1; pages <= MAX_ARENA_PAGES; pages++) {
+		size_t arena_size = pages * PGSIZE;
+		size_t blocks, waste;
+
+		if (pages == 1)
+			blocks = (arena_size - sizeof (struct arena)) / block_size;
+		else
+			blocks = (arena_size - MULTI_OFS)
+				/ (block_size + sizeof (struct block_hdr));
+		if (blocks == 0)
+			continue;
+
+		/* Compare waste as a fraction of the arena. */
+		waste = arena_size - blocks * block_size;
+		if (best_pages == 0 || waste * best_pages < best_waste * pages) {
+			best_pages = pages;
+			best_waste = waste;
+		}
+		if (waste <= arena_size / 16)
+			break;
+	}
+	ASSERT (best_pages > 0);
+
+	d->block_size = block_size;
+	d->arena_pages = best_pages;
+	if (best_pages == 1)
 		d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
-		list_init (&d->free_list);
-		lock_init (&d->lock);
+	else
+		d->blocks_per_arena = (best_pages * PGSIZE - MULTI_OFS)
+			/ (block_size + sizeof (struct block_hdr));
+	d->arena_cnt = 0;
+	list_init (&d->free_list);
+	lock_init (&d->lock);
+	snprintf (d->name, sizeof d->name, "malloc-%zu", block_size);
+	lock_set_name (&d->lock, d->name);
+}
+
+/* Returns the number of pages that malloc() has obtained from
+   the page allocator and not given back. */
+size_t
+malloc_page_cnt (void) {
+	size_t cnt = __atomic_load_n (&big_pages, __ATOMIC_RELAXED);
+	size_t i;
+
+	for (i = 0; i < DESC_CNT; i++)
+		cnt += descs[i].arena_cnt * descs[i].arena_pages;
+	return cnt;
+}
+
+/* Prints the arenas of each block size, and with HEAPSTAT how
+   full they are. */
+void
+malloc_print_stats (void) {
+	size_t i;
+
+	printf ("Malloc: block size, pages per arena, arenas");
+#ifdef HEAPSTAT
+	printf (", arenas by quarter of blocks in use");
+#endif
+	printf ("\n");
+	for (i = 0; i < DESC_CNT; i++) {
+		struct desc *d = &descs[i];
+
+		printf ("%zu: %zu, %zu", d->block_size, d->arena_pages, d->arena_cnt);
+#ifdef HEAPSTAT
+		for (size_t j = 0; j < OCCUPANCY_BUCKETS; j++)
+			printf ("%s%zu", j == 0 ? ", " : "/", d->occupancy[j]);
+#endif
+		printf ("\n");
 	}
+	printf ("Malloc: %zu pages in big blocks\n", big_pages);
 }
 
 /* Obtains and returns a new block of at least SIZE bytes.
    Returns a null pointer if memory is not available. */
 void *
 malloc (size_t size) {
-	struct desc *d;
-	struct block *b;
-	struct arena *a;
+	return tagged_malloc (size, __builtin_return_address (0));
+}
+
+/* Does the work of malloc() for a caller at SITE. */
+static void *
+tagged_malloc (size_t size, const void *site UNUSED) {
+	void *p;
 
 	/* A null pointer satisfies a request for 0 bytes. */
 	if (size == 0)
 		return NULL;
 
+	p = block_get (size + TAG_BYTES);
+#ifdef HEAPSTAT
+	if (p != NULL) {
+		size_t raw = block_size (p);
+		((uint8_t *) p)[raw - 1] = heapstat_alloc (HEAPSTAT_MALLOC, site, raw);
+	}
+#endif
+	return p;
+}
+
+/* Obtains and returns a new block of at least SIZE bytes, which
+   must be nonzero.  Returns a null pointer if memory is not
+   available. */
+static void *
+block_get (size_t size) {
+	struct desc *d;
+	struct block *b;
+
 	/* Find the smallest descriptor that satisfies a SIZE-byte
 	   request. */
-	for (d = descs; d < descs + desc_cnt; d++)
+	for (d = descs; d < descs + DESC_CNT; d++)
 		if (d->block_size >= size)
 			break;
-	if (d == descs + desc_cnt) {
-		/* SIZE is too big for any descriptor.
-		   Allocate enough pages to hold SIZE plus an arena. */
-		size_t page_cnt = DIV_ROUND_UP (size + sizeof *a, PGSIZE);
-		a = palloc_get_multiple (0, page_cnt);
-		if (a == NULL)
-			return NULL;
+	if (d == descs + DESC_CNT) {
+		/* SIZE is too big for any descriptor. */
+		return big_block (size);
+	}
 
-		/* Initialize the arena to indicate a big block of PAGE_CNT
-		   pages, and return it. */
-		a->magic = ARENA_MAGIC;
-		a->desc = NULL;
-		a->free_cnt = page_cnt;
-		return a + 1;
+	if (d - descs < MALLOC_MAG_CLASSES) {
+		/* Take a block from the running thread's magazine, first
+		   refilling it from the descriptor if it is empty. */
+		struct malloc_magazine *m = &thread_current ()->mags[d - descs];
+
+		if (m->cnt == 0) {
+			lock_acquire (&d->lock);
+			while (m->cnt < MAG_BATCH && (b = desc_take (d)) != NULL)
+				mag_push (m, b);
+			lock_release (&d->lock);
+		}
+		if (m->cnt > 0)
+			return mag_pop (m);
+	} else {
+		lock_acquire (&d->lock);
+		b = desc_take (d);
+		lock_release (&d->lock);
+		if (b != NULL)
+			return b;
 	}
+	return d->arena_pages > 1 ? big_block (size) : NULL;
+}
 
-	lock_acquire (&d->lock);
+/* Removes and returns a block from D's free list, first creating
+   a new arena if the list is empty.  Returns a null pointer if
+   memory is not available.  D's lock must be held. */
+static struct block *
+desc_take (struct desc *d) {
+	struct block *b;
+	struct arena *a;
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
 
 	/* If the free list is empty, create a new arena. */
 	if (list_empty (&d->free_list)) {
 		size_t i;
 
-		/* Allocate a page. */
-		a = palloc_get_page (0);
-		if (a == NULL) {
-			lock_release (&d->lock);
+		/* Allocate pages. */
+		a = palloc_get_multiple (0, d->arena_pages);
+		if (a == NULL)
 			return NULL;
-		}
 
 		/* Initialize arena and add its blocks to the free list. */
 		a->magic = ARENA_MAGIC;
@@ -131,18 +333,131 @@ malloc (size_t size) {
 		a->free_cnt = d->blocks_per_arena;
 		for (i = 0; i < d->blocks_per_arena; i++) {
 			struct block *b = arena_to_block (a, i);
+			if (d->arena_pages > 1) {
+				struct block_hdr *h = (struct block_hdr *) b - 1;
+				h->arena = a;
+				h->magic = BLOCK_MAGIC;
+			}
 			list_push_back (&d->free_list, &b->free_elem);
 		}
+		d->arena_cnt++;
 	}
 
 	/* Get a block from free list and return it. */
 	b = list_entry (list_pop_front (&d->free_list), struct block, free_elem);
 	a = block_to_arena (b);
 	a->free_cnt--;
-	lock_release (&d->lock);
+	occupancy_move (d, d->blocks_per_arena - a->free_cnt - 1,
+			d->blocks_per_arena - a->free_cnt);
+	return b;
+}
+
+/* Adds block B to D's free list, and gives its arena back to the
+   page allocator if the arena is now entirely unused.  D's lock
+   must be held. */
+static void
+desc_give (struct desc *d, struct block *b) {
+	struct arena *a = block_to_arena (b);
+
+	ASSERT (lock_held_by_current_thread (&d->lock));
+	ASSERT (a->desc == d);
+
+	/* Add block to free list. */
+	list_push_front (&d->free_list, &b->free_elem);
+
+	/* If the arena is now entirely unused, free it. */
+	a->free_cnt++;
+	occupancy_move (d, d->blocks_per_arena - a->free_cnt + 1,
+			d->blocks_per_arena - a->free_cnt);
+	if (a->free_cnt >= d->blocks_per_arena) {
+		size_t i;
+
+		ASSERT (a->free_cnt == d->blocks_per_arena);
+		for (i = 0; i < d->blocks_per_arena; i++) {
+			struct block *b = arena_to_block (a, i);
+			list_remove (&b->free_elem);
+		}
+		palloc_free_multiple (a, d->arena_pages);
+		d->arena_cnt--;
+	}
+}
+
+/* Records that an arena of D went from OLD_USED to NEW_USED
+   blocks in use.  An arena with no blocks in use is not counted.
+   Does nothing in a kernel built without HEAPSTAT. */
+static void
+occupancy_move (struct desc *d UNUSED, size_t old_used UNUSED,
+		size_t new_used UNUSED) {
+#ifdef HEAPSTAT
+	size_t bpa = d->blocks_per_arena;
+
+	if (old_used > 0)
+		d->occupancy[(old_used - 1) * OCCUPANCY_BUCKETS / bpa]--;
+	if (new_used > 0)
+		d->occupancy[(new_used - 1) * OCCUPANCY_BUCKETS / bpa]++;
+#endif
+}
+
+/* Pushes block B onto magazine M. */
+static void
+mag_push (struct malloc_magazine *m, struct block *b) {
+	b->mag_next = m->blocks;
+	m->blocks = b;
+	m->cnt++;
+}
+
+/* Pops and returns a block from magazine M, which must not be
+   empty. */
+static struct block *
+mag_pop (struct malloc_magazine *m) {
+	struct block *b = m->blocks;
+
+	ASSERT (m->cnt > 0);
+	m->blocks = b->mag_next;
+	m->cnt--;
 	return b;
 }
 
+/* Gives up to CNT blocks from magazine M back to descriptor D. */
+static void
+mag_drain (struct desc *d, struct malloc_magazine *m, size_t cnt) {
+	lock_acquire (&d->lock);
+	while (cnt-- > 0 && m->cnt > 0)
+		desc_give (d, mag_pop (m));
+	lock_release (&d->lock);
+}
+
+/* Gives every block in the running thread's magazines back to
+   its descriptor.  Called by a thread as it exits. */
+void
+malloc_drain (void) {
+	struct thread *t = thread_current ();
+	size_t i;
+
+	for (i = 0; i < MALLOC_MAG_CLASSES; i++)
+		if (t->mags[i].cnt > 0)
+			mag_drain (&descs[i], &t->mags[i], t->mags[i].cnt);
+}
+
+/* Allocates enough pages to hold SIZE bytes plus an arena, and
+   returns a big block in them.  Returns a null pointer if memory
+   is not available. */
+static void *
+big_block (size_t size) {
+	size_t page_cnt = DIV_ROUND_UP (size + sizeof (struct arena), PGSIZE);
+	struct arena *a = palloc_get_multiple (0, page_cnt);
+	if (a == NULL)
+		return NULL;
+
+	/* Initialize the arena to indicate a big block of PAGE_CNT
+	   pages, and return it. */
+	a->magic = ARENA_MAGIC;
+	a->desc = NULL;
+	a->free_cnt = page_cnt;
+	__atomic_fetch_add (&big_pages, page_cnt, __ATOMIC_RELAXED);
+	return a + 1;
+}
+
 /* Allocates and return A times B bytes initialized to zeroes.
    Returns a null pointer if memory is not available. */
 void *
@@ -156,14 +471,15 @@ calloc (size_t a, size_t b) {
 		return NULL;
 
 	/* Allocate and zero memory. */
-	p = malloc (size);
+	p = tagged_malloc (size, __builtin_return_address (0));
 	if (p != NULL)
 		memset (p, 0, size);
 
 	return p;
 }
 
-/* Returns the number of bytes allocated for BLOCK. */
+/* Returns the number of bytes allocated for BLOCK, including
+   its tag byte with HEAPSTAT. */
 static size_t
 block_size (void *block) {
 	struct block *b = block;
@@ -185,9 +501,10 @@ realloc (void *old_block, size_t new_size) {
 		free (old_block);
 		return NULL;
 	} else {
-		void *new_block = malloc (new_size);
+		void *new_block = tagged_malloc (new_size,
+				__builtin_return_address (0));
 		if (old_block != NULL && new_block != NULL) {
-			size_t old_size = block_size (old_block);
+			size_t old_size = block_size (old_block) - TAG_BYTES;
 			size_t min_size = new_size < old_size ? new_size : old_size;
 			memcpy (new_block, old_block, min_size);
 			free (old_block);
@@ -205,6 +522,11 @@ free (void *p) {
 		struct arena *a = block_to_arena (b);
 		struct desc *d = a->desc;
 
+#ifdef HEAPSTAT
+		size_t raw = block_size (p);
+		heapstat_free (((uint8_t *) p)[raw - 1], raw);
+#endif
+
 		if (d != NULL) {
 			/* It's a normal block.  We handle it here. */
 
@@ -213,26 +535,22 @@ free (void *p) {
 			memset (b, 0xcc, d->block_size);
 #endif
 
-			lock_acquire (&d->lock);
-
-			/* Add block to free list. */
-			list_push_front (&d->free_list, &b->free_elem);
-
-			/* If the arena is now entirely unused, free it. */
-			if (++a->free_cnt >= d->blocks_per_arena) {
-				size_t i;
-
-				ASSERT (a->free_cnt == d->blocks_per_arena);
-				for (i = 0; i < d->blocks_per_arena; i++) {
-					struct block *b = arena_to_block (a, i);
-					list_remove (&b->free_elem);
-				}
-				palloc_free_page (a);
+			if (d - descs < MALLOC_MAG_CLASSES) {
+				/* Put the block in the running thread's magazine,
+				   first making room if it is full. */
+				struct malloc_magazine *m = &thread_current ()->mags[d - descs];
+
+				if (m->cnt >= MAG_SIZE)
+					mag_drain (d, m, MAG_BATCH);
+				mag_push (m, b);
+			} else {
+				lock_acquire (&d->lock);
+				desc_give (d, b);
+				lock_release (&d->lock);
 			}
-
-			lock_release (&d->lock);
 		} else {
 			/* It's a big block.  Free its pages. */
+			__atomic_fetch_sub (&big_pages, a->free_cnt, __ATOMIC_RELAXED);
 			palloc_free_multiple (a, a->free_cnt);
 			return;
 		}
@@ -242,7 +560,23 @@ free (void *p) {
 /* Returns the arena that block B is inside. */
 static struct arena *
 block_to_arena (struct block *b) {
-	struct arena *a = pg_round_down (b);
+	struct arena *a;
+
+	if (pg_ofs (b) % 16 == 0) {
+		/* It's in a multi-page arena. */
+		struct block_hdr *h = (struct block_hdr *) b - 1;
+
+		ASSERT (h->magic == BLOCK_MAGIC);
+		a = h->arena;
+		ASSERT (a != NULL);
+		ASSERT (a->magic == ARENA_MAGIC);
+		ASSERT (a->desc != NULL && a->desc->arena_pages > 1);
+		ASSERT (((uint8_t *) h - (uint8_t *) a - MULTI_OFS)
+				% (a->desc->block_size + sizeof *h) == 0);
+		return a;
+	}
+
+	a = pg_round_down (b);
 
 	/* Check that the arena is valid. */
 	ASSERT (a != NULL);
@@ -262,6 +596,11 @@ arena_to_block (struct arena *a, size_t idx) {
 	ASSERT (a != NULL);
 	ASSERT (a->magic == ARENA_MAGIC);
 	ASSERT (idx < a->desc->blocks_per_arena);
+	if (a->desc->arena_pages > 1)
+		return (struct block *) ((uint8_t *) a
+				+ MULTI_OFS
+				+ idx * (a->desc->block_size + sizeof (struct block_hdr))
+				+ sizeof (struct block_hdr));
 	return (struct block *) ((uint8_t *) a
 			+ sizeof *a
 			+ idx * a->desc->block_size);
@@ -1,21 +1,114 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+/* Page-table pages.
+
+   Every level of the page tables is a page.  Freed page-table
+   pages are kept zeroed in a cache of up to PT_CACHE_MAX pages,
+   so that a fork/exit cycle reuses them without going through
+   the page allocator or clearing them again.  Teardown clears
+   each entry as it visits it, so the pages it frees are already
+   zero, and frees runs of adjacent user frames in one call.
+   Interrupts must be off to access the cache. */
+#define PT_CACHE_MAX 64
+static void *pt_cache[PT_CACHE_MAX];
+static size_t pt_cache_cnt;
+
+/* Page-table pages in use, and cache hits and misses. */
+static size_t pt_used;
+static long long pt_cache_hits, pt_cache_misses;
+
+/* Returns a zeroed page-table page, or a null pointer if memory
+ * is not available. */
+static void *
+pt_alloc (void) {
+	enum intr_level old_level = intr_disable ();
+	void *page = NULL;
+
+	if (pt_cache_cnt > 0) {
+		page = pt_cache[--pt_cache_cnt];
+		pt_cache_hits++;
+	} else
+		pt_cache_misses++;
+	intr_set_level (old_level);
+
+	if (page == NULL)
+		page = palloc_get_page (PAL_ZERO);
+	if (page != NULL)
+		__atomic_fetch_add (&pt_used, 1, __ATOMIC_RELAXED);
+	return page;
+}
+
+/* Frees page-table page PAGE, which must be zeroed. */
+static void
+pt_free (void *page) {
+	enum intr_level old_level;
+
+	__atomic_fetch_sub (&pt_used, 1, __ATOMIC_RELAXED);
+	old_level = intr_disable ();
+	if (pt_cache_cnt < PT_CACHE_MAX) {
+		pt_cache[pt_cache_cnt++] = page;
+		page = NULL;
+	}
+	intr_set_level (old_level);
+
+	if (page != NULL)
+		palloc_free_page (page);
+}
+
+/* Frees up to PAGE_CNT pages from the page-table page cache.
+ * Returns the number of pages freed.  The kernel pool's reclaim
+ * hook. */
+size_t
+pml4_cache_shrink (size_t page_cnt) {
+	void *pages[PT_CACHE_MAX];
+	enum intr_level old_level;
+	size_t cnt;
+
+	old_level = intr_disable ();
+	cnt = pt_cache_cnt < page_cnt ? pt_cache_cnt : page_cnt;
+	pt_cache_cnt -= cnt;
+	memcpy (pages, pt_cache + pt_cache_cnt, cnt * sizeof *pages);
+	intr_set_level (old_level);
+
+	for (size_t i = 0; i < cnt; i++)
+		palloc_free_page (pages[i]);
+	return cnt;
+}
+
+/* Returns the number of page-table page cache hits so far. */
+long long
+pml4_cache_hit_cnt (void) {
+	return pt_cache_hits;
+}
+
+/* Prints page-table page statistics. */
+void
+pml4_print_stats (void) {
+	printf ("Page tables: %zu pages in use, %zu cached, "
+			"%lld cache hits, %lld misses\n",
+			pt_used, pt_cache_cnt, pt_cache_hits, pt_cache_misses);
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
 	if (pdp) {
 		uint64_t *pte = (uint64_t *) pdp[idx];
+		if ((uint64_t) pte & PTE_PS)
+			return &pdp[idx];
 		if (!((uint64_t) pte & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = pt_alloc ();
 				if (new_page)
 					pdp[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 				else
@@ -37,7 +130,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		uint64_t *pde = (uint64_t *) pdpe[idx];
 		if (!((uint64_t) pde & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = pt_alloc ();
 				if (new_page) {
 					pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -49,7 +142,7 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pdpe[idx])));
+		pt_free ((void *) ptov (PTE_ADDR (pdpe[idx])));
 		pdpe[idx] = 0;
 	}
 	return pte;
@@ -60,7 +153,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR is in a 2 MB page, returns the address of the page
+ * directory entry that maps it, which has PTE_PS set. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -70,7 +165,7 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		uint64_t *pdpe = (uint64_t *) pml4e[idx];
 		if (!((uint64_t) pdpe & PTE_P)) {
 			if (create) {
-				uint64_t *new_page = palloc_get_page (PAL_ZERO);
+				uint64_t *new_page = pt_alloc ();
 				if (new_page) {
 					pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
 					allocated = 1;
@@ -82,19 +177,49 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 		pte = pdpe_walk (ptov (PTE_ADDR (pml4e[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
-		palloc_free_page ((void *) ptov (PTE_ADDR (pml4e[idx])));
+		pt_free ((void *) ptov (PTE_ADDR (pml4e[idx])));
 		pml4e[idx] = 0;
 	}
 	return pte;
 }
 
+/* Returns the address of the page directory entry for virtual
+ * address VA in PML4, which maps the 2 MB page at VA if PTE_PS is
+ * set in it and otherwise points to a page table.
+ * If PML4 has no page directory for VA, behavior depends on
+ * CREATE, as for pml4e_walk(). */
+uint64_t *
+pml4_pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *pdpe, *pde;
+	int allocated = 0;
+
+	if (!(pml4[PML4 (va)] & PTE_P)) {
+		if (!create || (pdpe = pt_alloc ()) == NULL)
+			return NULL;
+		pml4[PML4 (va)] = vtop (pdpe) | PTE_U | PTE_W | PTE_P;
+		allocated = 1;
+	}
+	pdpe = ptov (PTE_ADDR (pml4[PML4 (va)]));
+	if (!(pdpe[PDPE (va)] & PTE_P)) {
+		if (!create || (pde = pt_alloc ()) == NULL) {
+			if (allocated) {
+				pt_free (pdpe);
+				pml4[PML4 (va)] = 0;
+			}
+			return NULL;
+		}
+		pdpe[PDPE (va)] = vtop (pde) | PTE_U | PTE_W | PTE_P;
+	}
+	return (uint64_t *) ptov (PTE_ADDR (pdpe[PDPE (va)])) + PDX (va);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *
 pml4_create (void) {
-	uint64_t *pml4 = palloc_get_page (0);
+	uint64_t *pml4 = pt_alloc ();
 	if (pml4)
 		memcpy (pml4, base_pml4, PGSIZE);
 	return pml4;
@@ -122,10 +247,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
-					pml4_index, pdp_index, i))
+		if (!(((uint64_t) pte) & PTE_P))
+			continue;
+		if (pdp[i] & PTE_PS) {
+			void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+								 ((uint64_t) pdp_index << PDPESHIFT) |
+								 ((uint64_t) i << PDXSHIFT));
+			if (!func (&pdp[i], va, aux))
 				return false;
+		} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+					pml4_index, pdp_index, i))
+			return false;
 	}
 	return true;
 }
@@ -155,34 +287,60 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	return true;
 }
 
+/* A run of adjacent frames to free with one call. */
+struct frame_run {
+	uint8_t *start;             /* First frame, or null. */
+	size_t cnt;                 /* Number of frames. */
+};
+
+/* Adds the CNT frames at FRAMES to RUN, first freeing the frames
+ * already in RUN if they are not adjacent. */
 static void
-pt_destroy (uint64_t *pt) {
+frame_run_add (struct frame_run *run, void *frames, size_t cnt) {
+	if (run->start != NULL && run->start + run->cnt * PGSIZE == frames) {
+		run->cnt += cnt;
+		return;
+	}
+	palloc_free_multiple (run->start, run->cnt);
+	run->start = frames;
+	run->cnt = cnt;
+}
+
+static void
+pt_destroy (uint64_t *pt, struct frame_run *run) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pt[i]);
 		if (((uint64_t) pte) & PTE_P)
-			palloc_free_page ((void *) PTE_ADDR (pte));
+			frame_run_add (run, (void *) PTE_ADDR (pte), 1);
+		pt[i] = 0;
 	}
-	palloc_free_page ((void *) pt);
+	pt_free ((void *) pt);
 }
 
 static void
-pgdir_destroy (uint64_t *pdp) {
+pgdir_destroy (uint64_t *pdp, struct frame_run *run) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (pdp[i] & PTE_PS)
+				frame_run_add (run, (void *) PTE_ADDR (pte), LARGE_PGCNT);
+			else
+				pt_destroy ((uint64_t *) PTE_ADDR (pte), run);
+		}
+		pdp[i] = 0;
 	}
-	palloc_free_page ((void *) pdp);
+	pt_free ((void *) pdp);
 }
 
 static void
-pdpe_destroy (uint64_t *pdpe) {
+pdpe_destroy (uint64_t *pdpe, struct frame_run *run) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
 		if (((uint64_t) pde) & PTE_P)
-			pgdir_destroy ((void *) PTE_ADDR (pde));
+			pgdir_destroy ((void *) PTE_ADDR (pde), run);
+		pdpe[i] = 0;
 	}
-	palloc_free_page ((void *) pdpe);
+	pt_free ((void *) pdpe);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
@@ -193,10 +351,15 @@ pml4_destroy (uint64_t *pml4) {
 	ASSERT (pml4 != base_pml4);
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
+	struct frame_run run = { NULL, 0 };
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
 	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));
-	palloc_free_page ((void *) pml4);
+		pdpe_destroy ((void *) PTE_ADDR (pdpe), &run);
+	palloc_free_multiple (run.start, run.cnt);
+
+	/* The rest holds the kernel's entries, copied from base_pml4. */
+	memset (pml4, 0, PGSIZE);
+	pt_free ((void *) pml4);
 }
 
 /* Loads page directory PD into the CPU's page directory base
@@ -216,8 +379,12 @@ pml4_get_page (uint64_t *pml4, const void *uaddr) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
 
-	if (pte && (*pte & PTE_P))
+	if (pte && (*pte & PTE_P)) {
+		if (*pte & PTE_PS)
+			return ptov (PTE_ADDR (*pte))
+				+ ((uint64_t) uaddr & (LARGE_PGSIZE - 1));
 		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+	}
 	return NULL;
 }
 
@@ -238,15 +405,38 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		ASSERT (!(*pte & PTE_PS));
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	}
 	return pte != NULL;
 }
 
+/* Like pml4_set_page(), but maps the 2 MB of physical memory at
+ * KPAGE with a single page directory entry.  UPAGE and KPAGE
+ * must both be aligned on 2 MB, and KPAGE should be obtained with
+ * palloc_get_large().  Returns false if memory allocation fails
+ * or if any of UPAGE's 2 MB is already mapped. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (((uint64_t) upage & (LARGE_PGSIZE - 1)) == 0);
+	ASSERT ((vtop (kpage) & (LARGE_PGSIZE - 1)) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4_pde_walk (pml4, (uint64_t) upage, 1);
+
+	if (pde == NULL || (*pde & PTE_P))
+		return false;
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If it is in a 2 MB page, the whole
+ * 2 MB page is marked not present. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
@@ -2,14 +2,19 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/heapstat.h"
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
-#include "threads/synch.h"
+#include "threads/mmu.h"
+#include "threads/pte.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -24,15 +29,102 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool is a binary buddy allocator.  Its free pages form
+   blocks of 2**k pages, for "order" k, that start at a multiple
+   of 2**k pages from the pool's base, with a free list per order.
+   An allocation of N pages splits the smallest free block of at
+   least N pages in halves until it is just big enough, and gives
+   back any pages past the first N.  A freed block is merged with
+   its "buddy", the other half of the block of the next order up,
+   for as long as the buddy is free.  Both take O(log n) time.
+
+   Buddy blocks must be aligned, so N free pages in a row may not
+   form a big enough block.  Then the allocator falls back to a
+   first-fit scan of the pool's bitmap of used pages, and carves
+   the run it finds out of the blocks that hold it.
+
+   The free lists are threaded through the free pages themselves.
+   They are protected by turning interrupts off, not by a lock,
+   because the scheduler frees the pages of dying threads.
+
+   Each pool has a low and a high watermark on its free pages.
+   An allocation that leaves fewer than the low watermark free
+   calls the pool's reclaim hooks, which subsystems that cache
+   pages register with palloc_add_reclaim(), until the high
+   watermark is free again.  A failed allocation calls them too
+   before giving up.  The user pool also holds back an emergency
+   reserve that only PAL_RESERVE allocations may use.  The page
+   fault handler passes it to copy a copy-on-write page, so that
+   a write fault can still be resolved after loading and forking
+   have used up the rest of the pool.
+
+   An allocated page may be shared, as copy-on-write fork shares
+   user pages between parent and child.  palloc_share_page() adds
+   a reference to it, and palloc_free_page() drops one, freeing
+   the page only with the last. */
+
+/* Most pages each pool keeps zeroed ahead of time, as the idle
+   thread finds time to zero them. */
+#define ZEROED_MAX 64
+
+/* Number of buddy block orders.  The biggest block is 2**18 pages,
+   or 1 GB. */
+#define POOL_ORDERS 19
+
+/* The low watermark is 1/WMARK_DIV of a pool's pages, but at
+   least WMARK_MIN pages.  The high watermark is twice that. */
+#define WMARK_DIV 64
+#define WMARK_MIN 4
+
+/* Pages in the user pool's emergency reserve. */
+#define RESERVE_PAGES 16
+
+/* Most reclaim hooks per pool. */
+#define RECLAIM_MAX 4
+
+/* Most extra references to a shared page. */
+#define SHARE_MAX UINT8_MAX
 
 /* A memory pool. */
 struct pool {
-	struct lock lock;               /* Mutual exclusion. */
-	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct bitmap *used_map;        /* Bitmap of used pages. */
+	uint8_t *order_map;             /* Per page, 1 + its block's order
+	                                   if it starts a free block,
+	                                   otherwise 0. */
+	uint8_t *share_map;             /* Per allocated page, its number
+	                                   of references less one. */
+	size_t shared_cnt;              /* Number of shared pages. */
+	struct list free_lists[POOL_ORDERS]; /* Free blocks, by order. */
+	struct list zeroed;             /* Pages zeroed by the idle thread,
+	                                   allocated but not handed out. */
+	size_t zeroed_cnt;              /* Number of pages in `zeroed'. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
+	size_t min_free;                /* Fewest free pages seen. */
+	size_t low, high;               /* Reclaim watermarks. */
+	size_t reserve;                 /* Emergency reserve pages. */
+	palloc_reclaim_func *reclaim[RECLAIM_MAX]; /* Reclaim hooks. */
+	size_t reclaim_cnt;             /* Number of reclaim hooks. */
+	bool reclaiming;                /* Reclaim hooks are running? */
+	long long reclaims;             /* Times reclaim hooks ran. */
+	long long reclaimed;            /* Pages they freed. */
+	long long reserve_allocs;       /* Allocations that dipped into
+	                                   the reserve. */
+	long long failures;             /* Allocations that failed. */
+#ifdef HEAPSTAT
+	uint8_t *tag_map;               /* Per allocated page, its
+	                                   heapstat tag. */
+#endif
 };
 
+/* Single-page PAL_ZERO allocations served pre-zeroed or not. */
+static long long zeroed_hits, zeroed_misses;
+
+/* Pages zeroed by the idle thread. */
+static long long zeroed_idle;
+
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
@@ -42,6 +134,17 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_release (struct pool *, size_t page_idx, size_t page_cnt);
+static size_t pool_take (struct pool *, size_t page_cnt, size_t keep);
+static void pool_free (struct pool *, size_t page_idx, size_t page_cnt);
+static bool page_unshare (struct pool *, size_t page_idx);
+static size_t pool_reclaim (struct pool *, size_t target);
+static void set_watermarks (struct pool *, size_t reserve);
+static void *zeroed_take (struct pool *);
+static size_t zeroed_drain (struct pool *, size_t page_cnt);
+static void *get_pages (enum palloc_flags, size_t page_cnt, const void *site);
+static void charge_pages (struct pool *, void *pages, size_t page_cnt,
+		const void *site);
 
 /* multiboot info */
 struct multiboot_info {
@@ -223,12 +326,12 @@ split:
 			page_idx = pg_no (start) - pg_no (pool->base);
 			if ((uint64_t) pool_end < end) {
 				page_cnt = ((uint64_t) pool_end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_release (pool, page_idx, page_cnt);
 				start = (uint64_t) pool_end;
 				goto split;
 			} else {
 				page_cnt = ((uint64_t) end - start) / PGSIZE;
-				bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+				pool_release (pool, page_idx, page_cnt);
 			}
 		}
 	}
@@ -250,6 +353,8 @@ palloc_init (void) {
 	printf ("\text_mem: 0x%llx ~ 0x%llx (Usable: %'llu kB)\n",
 		  ext_mem.start, ext_mem.end, ext_mem.size / 1024);
 	populate_pools (&base_mem, &ext_mem);
+	set_watermarks (&kernel_pool, 0);
+	set_watermarks (&user_pool, RESERVE_PAGES);
 	return ext_mem.end;
 }
 
@@ -258,16 +363,41 @@ palloc_init (void) {
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
    then the pages are filled with zeros.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
-   FLAGS, in which case the kernel panics. */
+   FLAGS, in which case the kernel panics.  Only PAL_RESERVE
+   allocations may use the user pool's emergency reserve. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
-	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return get_pages (flags, page_cnt, __builtin_return_address (0));
+}
 
-	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-	lock_release (&pool->lock);
+/* Does the work of palloc_get_multiple() for a caller at SITE. */
+static void *
+get_pages (enum palloc_flags flags, size_t page_cnt, const void *site) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx, keep;
 	void *pages;
 
+	if (page_cnt == 0)
+		return NULL;
+
+	/* Leave the reserve to PAL_RESERVE allocations. */
+	keep = flags & PAL_RESERVE ? 0 : pool->reserve;
+
+	if ((flags & PAL_ZERO) && page_cnt == 1) {
+		pages = zeroed_take (pool);
+		if (pages != NULL) {
+			charge_pages (pool, pages, 1, site);
+			return pages;
+		}
+	}
+
+	page_idx = pool_take (pool, page_cnt, keep);
+	if (page_idx == BITMAP_ERROR
+			&& pool_reclaim (pool, pool->free_cnt + page_cnt) > 0) {
+		/* Retry with the reclaimed pages. */
+		page_idx = pool_take (pool, page_cnt, keep);
+	}
+
 	if (page_idx != BITMAP_ERROR)
 		pages = pool->base + PGSIZE * page_idx;
 	else
@@ -276,7 +406,14 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	if (pages) {
 		if (flags & PAL_ZERO)
 			memset (pages, 0, PGSIZE * page_cnt);
+		charge_pages (pool, pages, page_cnt, site);
+
+		/* Free pages ahead of need, rather than on the next
+		   allocation that finds the pool empty. */
+		if (pool->free_cnt < pool->low)
+			pool_reclaim (pool, pool->high);
 	} else {
+		pool->failures++;
 		if (flags & PAL_ASSERT)
 			PANIC ("palloc_get: out of pages");
 	}
@@ -284,6 +421,107 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Obtains and returns LARGE_PGCNT contiguous free pages that
+   start on a 2 MB boundary, for mapping as one large page.
+   FLAGS are interpreted as by palloc_get_multiple(). */
+void *
+palloc_get_large (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_cnt = 2 * LARGE_PGCNT - 1;
+	size_t page_idx, head;
+	uint8_t *pages;
+
+	/* Any run of PAGE_CNT pages holds an aligned large page.  Take
+	   one and give back the pages around it. */
+	page_idx = pool_take (pool, page_cnt, pool->reserve);
+	if (page_idx == BITMAP_ERROR) {
+		pool->failures++;
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get_large: out of pages");
+		return NULL;
+	}
+	pages = pool->base + PGSIZE * page_idx;
+	head = (ROUND_UP ((uint64_t) pages, LARGE_PGSIZE) - (uint64_t) pages)
+		/ PGSIZE;
+	if (head > 0)
+		pool_release (pool, page_idx, head);
+	if (head + LARGE_PGCNT < page_cnt)
+		pool_release (pool, page_idx + head + LARGE_PGCNT,
+				page_cnt - head - LARGE_PGCNT);
+	pages += PGSIZE * head;
+
+	if (flags & PAL_ZERO)
+		memset (pages, 0, LARGE_PGSIZE);
+	charge_pages (pool, pages, LARGE_PGCNT, __builtin_return_address (0));
+	return pages;
+}
+
+/* Tops up the pools' stocks of zeroed pages, which serve
+   single-page PAL_ZERO allocations without a memset() on the
+   caller's path.  Called by the idle thread, with interrupts on,
+   so that any thread that becomes ready preempts it.  Stops at a
+   pool's high watermark, so as not to set off reclaim. */
+void
+palloc_zero_idle (void) {
+	struct pool *pools[] = { &kernel_pool, &user_pool };
+	size_t i;
+
+	for (i = 0; i < sizeof pools / sizeof *pools; i++) {
+		struct pool *pool = pools[i];
+
+		while (pool->zeroed_cnt < ZEROED_MAX) {
+			size_t page_idx = pool_take (pool, 1, pool->high);
+			uint8_t *page;
+			enum intr_level old_level;
+
+			if (page_idx == BITMAP_ERROR)
+				break;
+			page = pool->base + PGSIZE * page_idx;
+			memset (page, 0, PGSIZE);
+
+			old_level = intr_disable ();
+			list_push_back (&pool->zeroed, (struct list_elem *) page);
+			pool->zeroed_cnt++;
+			zeroed_idle++;
+			intr_set_level (old_level);
+		}
+	}
+}
+
+/* Adds HOOK to the reclaim hooks of the user pool, if PAL_USER
+   is set in FLAGS, otherwise of the kernel pool.  Hooks are
+   called in the order they were added. */
+void
+palloc_add_reclaim (enum palloc_flags flags, palloc_reclaim_func *hook) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+
+	ASSERT (pool->reclaim_cnt < RECLAIM_MAX);
+	pool->reclaim[pool->reclaim_cnt++] = hook;
+}
+
+/* Prints POOL's statistics under the name NAME. */
+static void
+print_pool_stats (const char *name, const struct pool *pool) {
+	printf ("Palloc: %s pool: %zu of %zu pages free (fewest %zu), "
+			"watermarks %zu/%zu, %zu reserved\n",
+			name, pool->free_cnt, bitmap_size (pool->used_map),
+			pool->min_free, pool->low, pool->high, pool->reserve);
+	printf ("Palloc: %s pool: %lld reclaims freed %lld pages, "
+			"%lld reserve allocations, %lld failures\n",
+			name, pool->reclaims, pool->reclaimed, pool->reserve_allocs,
+			pool->failures);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Palloc: %lld zeroed page hits, %lld misses, "
+			"%lld pages zeroed while idle\n",
+			zeroed_hits, zeroed_misses, zeroed_idle);
+	print_pool_stats ("kernel", &kernel_pool);
+	print_pool_stats ("user", &user_pool);
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -293,14 +531,15 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_page (enum palloc_flags flags) {
-	return palloc_get_multiple (flags, 1);
+	return get_pages (flags, 1, __builtin_return_address (0));
 }
 
-/* Frees the PAGE_CNT pages starting at PAGES. */
+/* Frees the PAGE_CNT pages starting at PAGES, which may span
+   both pools. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
-	size_t page_idx;
+	size_t page_idx, pool_cnt;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -314,12 +553,27 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 		NOT_REACHED ();
 
 	page_idx = pg_no (pages) - pg_no (pool->base);
+	pool_cnt = bitmap_size (pool->used_map);
+	if (page_idx + page_cnt > pool_cnt) {
+		size_t cnt = pool_cnt - page_idx;
 
-#ifndef NDEBUG
-	memset (pages, 0xcc, PGSIZE * page_cnt);
-#endif
-	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+		palloc_free_multiple ((uint8_t *) pages + PGSIZE * cnt, page_cnt - cnt);
+		page_cnt = cnt;
+	}
+
+	if (pool->shared_cnt > 0) {
+		/* Shared pages lose a reference instead of being freed. */
+		size_t run = 0, i;
+
+		for (i = 0; i < page_cnt; i++)
+			if (page_unshare (pool, page_idx + i)) {
+				pool_free (pool, page_idx + i - run, run);
+				run = 0;
+			} else
+				run++;
+		pool_free (pool, page_idx + page_cnt - run, run);
+	} else
+		pool_free (pool, page_idx, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +582,40 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Adds a reference to PAGE, which must be allocated, so that it
+   takes one more palloc_free_page() to free it.  Returns false,
+   without adding one, if PAGE has too many references already. */
+bool
+palloc_share_page (void *page) {
+	struct pool *pool = page_from_pool (&kernel_pool, page)
+		? &kernel_pool : &user_pool;
+	size_t page_idx = pg_no (page) - pg_no (pool->base);
+	enum intr_level old_level;
+	bool success = false;
+
+	ASSERT (page_from_pool (pool, page));
+	ASSERT (bitmap_test (pool->used_map, page_idx));
+
+	old_level = intr_disable ();
+	if (pool->share_map[page_idx] < SHARE_MAX) {
+		if (pool->share_map[page_idx]++ == 0)
+			pool->shared_cnt++;
+		success = true;
+	}
+	intr_set_level (old_level);
+	return success;
+}
+
+/* Returns true if PAGE has more than one reference. */
+bool
+palloc_page_shared (void *page) {
+	struct pool *pool = page_from_pool (&kernel_pool, page)
+		? &kernel_pool : &user_pool;
+
+	ASSERT (page_from_pool (pool, page));
+	return pool->share_map[pg_no (page) - pg_no (pool->base)] > 0;
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -336,15 +624,60 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
 	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t om_pages = DIV_ROUND_UP (pgcnt, PGSIZE) * PGSIZE;
+	int order;
 
-	lock_init(&p->lock);
 	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->order_map = *bm_base + bm_pages;
+	memset (p->order_map, 0, om_pages);
+	p->share_map = p->order_map + om_pages;
+	memset (p->share_map, 0, om_pages);
+	p->shared_cnt = 0;
+	*bm_base += om_pages;
+#ifdef HEAPSTAT
+	p->tag_map = p->share_map + om_pages;
+	*bm_base += om_pages;
+#endif
+	for (order = 0; order < POOL_ORDERS; order++)
+		list_init (&p->free_lists[order]);
+	list_init (&p->zeroed);
+	p->zeroed_cnt = 0;
 	p->base = (void *) start;
+	p->free_cnt = 0;
 
 	// Mark all to unusable.
 	bitmap_set_all(p->used_map, true);
 
-	*bm_base += bm_pages;
+	*bm_base += bm_pages + om_pages;
+}
+
+/* Sets POOL's watermarks from its number of free pages, and
+   holds back RESERVE of them as its emergency reserve.  The
+   watermarks count free pages above the reserve. */
+static void
+set_watermarks (struct pool *pool, size_t reserve) {
+	if (reserve > pool->free_cnt / 16)
+		reserve = pool->free_cnt / 16;
+	pool->reserve = reserve;
+	pool->low = pool->free_cnt / WMARK_DIV;
+	if (pool->low < WMARK_MIN)
+		pool->low = WMARK_MIN;
+	pool->low += reserve;
+	pool->high = 2 * pool->low - reserve;
+	pool->min_free = pool->free_cnt;
+}
+
+/* Charges the PAGE_CNT pages at PAGES in POOL to the allocation
+   site SITE.  Does nothing in a kernel built without HEAPSTAT. */
+static void
+charge_pages (struct pool *pool UNUSED, void *pages UNUSED,
+		size_t page_cnt UNUSED, const void *site UNUSED) {
+#ifdef HEAPSTAT
+	size_t page_idx = pg_no (pages) - pg_no (pool->base);
+	uint8_t tag = heapstat_alloc (HEAPSTAT_PAGES, site, PGSIZE * page_cnt);
+
+	memset (pool->tag_map + page_idx, tag, page_cnt);
+#endif
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -356,3 +689,271 @@ page_from_pool (const struct pool *pool, void *page) {
 	size_t end_page = start_page + bitmap_size (pool->used_map);
 	return page_no >= start_page && page_no < end_page;
 }
+
+/* Returns the free list element stored in page PAGE_IDX of POOL. */
+static struct list_elem *
+block_elem (struct pool *pool, size_t page_idx) {
+	return (struct list_elem *) (pool->base + PGSIZE * page_idx);
+}
+
+/* Returns the index of the page that holds list element E. */
+static size_t
+block_idx (struct pool *pool, struct list_elem *e) {
+	return pg_no (e) - pg_no (pool->base);
+}
+
+/* Adds the block of 2**ORDER pages at PAGE_IDX to POOL's free
+   lists, as is. */
+static void
+block_insert (struct pool *pool, size_t page_idx, int order) {
+	pool->order_map[page_idx] = order + 1;
+	list_push_front (&pool->free_lists[order], block_elem (pool, page_idx));
+}
+
+/* Removes the free block of 2**ORDER pages at PAGE_IDX from
+   POOL's free lists. */
+static void
+block_remove (struct pool *pool, size_t page_idx, int order) {
+	ASSERT (pool->order_map[page_idx] == order + 1);
+
+	pool->order_map[page_idx] = 0;
+	list_remove (block_elem (pool, page_idx));
+}
+
+/* Frees the block of 2**ORDER pages at PAGE_IDX in POOL, merging
+   it with its buddy for as long as the buddy is free. */
+static void
+block_free (struct pool *pool, size_t page_idx, int order) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+
+	while (order + 1 < POOL_ORDERS) {
+		size_t buddy = page_idx ^ ((size_t) 1 << order);
+
+		if (buddy + ((size_t) 1 << order) > page_cnt
+				|| pool->order_map[buddy] != order + 1)
+			break;
+		block_remove (pool, buddy, order);
+		if (buddy < page_idx)
+			page_idx = buddy;
+		order++;
+	}
+	block_insert (pool, page_idx, order);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, which need not
+   be a buddy block, as the biggest blocks that tile them.
+   Interrupts must be off. */
+static void
+blocks_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	while (page_cnt > 0) {
+		int order = 63 - __builtin_clzll (page_cnt);
+
+		if (page_idx != 0 && __builtin_ctzll (page_idx) < order)
+			order = __builtin_ctzll (page_idx);
+		if (order >= POOL_ORDERS)
+			order = POOL_ORDERS - 1;
+		block_free (pool, page_idx, order);
+		page_idx += (size_t) 1 << order;
+		page_cnt -= (size_t) 1 << order;
+	}
+}
+
+/* Returns the index of the first page of the free block in POOL
+   that contains page PAGE_IDX, and stores its order in *ORDER. */
+static size_t
+block_containing (struct pool *pool, size_t page_idx, int *order) {
+	int k;
+
+	for (k = 0; k < POOL_ORDERS; k++) {
+		size_t head = page_idx & ~(((size_t) 1 << k) - 1);
+
+		if (pool->order_map[head] == k + 1) {
+			*order = k;
+			return head;
+		}
+	}
+	NOT_REACHED ();
+}
+
+/* Marks the PAGE_CNT pages at PAGE_IDX in POOL, which are in use,
+   free. */
+static void
+pool_release (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	blocks_free (pool, page_idx, page_cnt);
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL, which are in use
+   and not shared. */
+static void
+pool_free (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	if (page_cnt == 0)
+		return;
+#ifdef HEAPSTAT
+	for (size_t i = 0; i < page_cnt; i++)
+		heapstat_free (pool->tag_map[page_idx + i], PGSIZE);
+#endif
+
+#ifndef NDEBUG
+	memset (pool->base + PGSIZE * page_idx, 0xcc, PGSIZE * page_cnt);
+#endif
+	pool_release (pool, page_idx, page_cnt);
+}
+
+/* Drops a reference to page PAGE_IDX in POOL if it is shared.
+   Returns true if it was, false if it was not and so is to be
+   freed. */
+static bool
+page_unshare (struct pool *pool, size_t page_idx) {
+	enum intr_level old_level = intr_disable ();
+	bool shared = pool->share_map[page_idx] > 0;
+
+	if (shared && --pool->share_map[page_idx] == 0)
+		pool->shared_cnt--;
+	intr_set_level (old_level);
+	return shared;
+}
+
+/* Allocates PAGE_CNT contiguous pages from POOL and returns the
+   index of the first, or BITMAP_ERROR if there is no such run or
+   if taking it would leave fewer than KEEP pages free. */
+static size_t
+pool_take (struct pool *pool, size_t page_cnt, size_t keep) {
+	int want = page_cnt > 1 ? 64 - __builtin_clzll (page_cnt - 1) : 0;
+	enum intr_level old_level = intr_disable ();
+	size_t page_idx = BITMAP_ERROR;
+	int order;
+
+	if (pool->free_cnt < page_cnt + keep) {
+		intr_set_level (old_level);
+		return BITMAP_ERROR;
+	}
+
+	/* Split the smallest block that is big enough. */
+	for (order = want; order < POOL_ORDERS; order++) {
+		if (!list_empty (&pool->free_lists[order])) {
+			page_idx = block_idx (pool,
+					list_front (&pool->free_lists[order]));
+			block_remove (pool, page_idx, order);
+			while (order > want) {
+				order--;
+				block_insert (pool, page_idx + ((size_t) 1 << order), order);
+			}
+			blocks_free (pool, page_idx + page_cnt,
+					((size_t) 1 << want) - page_cnt);
+			break;
+		}
+	}
+
+	/* No block is big enough, but there may be a long enough run
+	   of free pages that straddles blocks.  Take the blocks that
+	   hold it and free the pages outside it again. */
+	if (page_idx == BITMAP_ERROR) {
+		page_idx = bitmap_scan (pool->used_map, 0, page_cnt, false);
+		if (page_idx != BITMAP_ERROR) {
+			size_t end = page_idx + page_cnt, first = 0, last = 0, i;
+
+			for (i = page_idx; i < end; ) {
+				size_t head = block_containing (pool, i, &order);
+
+				if (i == page_idx)
+					first = head;
+				block_remove (pool, head, order);
+				i = last = head + ((size_t) 1 << order);
+			}
+			blocks_free (pool, first, page_idx - first);
+			blocks_free (pool, end, last - end);
+		}
+	}
+
+	if (page_idx != BITMAP_ERROR) {
+		bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+		pool->free_cnt -= page_cnt;
+		if (pool->free_cnt < pool->min_free)
+			pool->min_free = pool->free_cnt;
+		if (keep == 0 && pool->free_cnt < pool->reserve)
+			pool->reserve_allocs++;
+	}
+	intr_set_level (old_level);
+	return page_idx;
+}
+
+/* Gives back as many of POOL's pre-zeroed pages as it takes to
+   have TARGET pages free, then, if that is not enough, calls its
+   reclaim hooks in turn until it is.  The hooks are skipped in
+   interrupt context, with interrupts off, or while another
+   thread is running them.  Returns the number of pages freed. */
+static size_t
+pool_reclaim (struct pool *pool, size_t target) {
+	size_t free_cnt = pool->free_cnt;
+	size_t freed = 0;
+	enum intr_level old_level;
+	bool busy;
+
+	if (free_cnt < target)
+		freed = zeroed_drain (pool, target - free_cnt);
+	if (pool->free_cnt >= target
+			|| intr_context () || intr_get_level () == INTR_OFF)
+		return freed;
+	old_level = intr_disable ();
+	busy = pool->reclaiming;
+	pool->reclaiming = true;
+	intr_set_level (old_level);
+	if (busy)
+		return freed;
+
+	for (size_t i = 0; i < pool->reclaim_cnt; i++) {
+		free_cnt = pool->free_cnt;
+		if (free_cnt >= target)
+			break;
+		freed += pool->reclaim[i] (target - free_cnt);
+	}
+	pool->reclaims++;
+	pool->reclaimed += freed;
+	pool->reclaiming = false;
+	return freed;
+}
+
+/* Returns one of POOL's pre-zeroed pages, or a null pointer if it
+   has none. */
+static void *
+zeroed_take (struct pool *pool) {
+	struct list_elem *e = NULL;
+	enum intr_level old_level = intr_disable ();
+
+	if (!list_empty (&pool->zeroed)) {
+		e = list_pop_front (&pool->zeroed);
+		pool->zeroed_cnt--;
+		zeroed_hits++;
+	} else
+		zeroed_misses++;
+	intr_set_level (old_level);
+
+	/* The list link was the page's only nonzero bytes. */
+	if (e != NULL)
+		memset (e, 0, sizeof *e);
+	return e;
+}
+
+/* Frees up to PAGE_CNT of POOL's pre-zeroed pages and returns
+   how many it freed. */
+static size_t
+zeroed_drain (struct pool *pool, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+	size_t cnt = 0;
+
+	while (cnt < page_cnt && !list_empty (&pool->zeroed)) {
+		struct list_elem *e = list_pop_front (&pool->zeroed);
+
+		pool_release (pool, pg_no (e) - pg_no (pool->base), 1);
+		cnt++;
+	}
+	pool->zeroed_cnt -= cnt;
+	intr_set_level (old_level);
+	return cnt;
+}
@@ -0,0 +1,246 @@
+#include "threads/slab.h"
+#include <list.h>
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Object caches.
+
+   malloc() rounds each request up to its next size class, a
+   power of 2 below 1 kB, so an object just over a power of 2
+   there wastes nearly half its block.  A cache instead holds
+   objects of one exact size, for a kind of object that the
+   kernel allocates often, such as inodes.
+
+   A cache carves pages, called "slabs", into objects.  A slab
+   starts with a header, followed by as many objects as fit; its
+   free objects are chained through their first bytes.  The cache
+   keeps its slabs on two lists: "partial" slabs have both free
+   and used objects, "full" slabs have no free objects, and at
+   most one "empty" slab, whose objects are all free, is kept
+   back for the next allocation.  Any other slab that empties is
+   given back to the page allocator.  Allocation takes an object
+   from the first partial slab, so it and freeing are O(1).
+
+   A cache may have a constructor.  It initializes each object
+   once, when its slab is created, not on every allocation, so
+   objects must be freed in their constructed state.  The free
+   chain then runs through an extra word after each object, so as
+   not to overwrite it.  Without a constructor, freed objects are
+   filled with 0xcc to help detect use-after-free bugs, as in
+   malloc(). */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* An object cache. */
+struct kmem_cache {
+	const char *name;           /* Name, for statistics. */
+	size_t size;                /* Size of each object, as created. */
+	size_t obj_size;            /* Space taken by each object. */
+	size_t link_ofs;            /* Offset of free chain link. */
+	size_t objs_per_slab;       /* Number of objects in a slab. */
+	kmem_ctor_func *ctor;       /* Constructor, or null. */
+	void *aux;                  /* Auxiliary data for `ctor'. */
+	struct lock lock;           /* Protects the members below. */
+	struct list partial;        /* Slabs with free and used objects. */
+	struct list full;           /* Slabs with no free objects. */
+	struct slab *empty;         /* A slab with no used objects. */
+	size_t slab_cnt;            /* Number of slabs. */
+	size_t used_cnt;            /* Number of objects in use. */
+	struct kmem_cache *next;    /* Next cache in `caches'. */
+};
+
+/* Slab header, at the start of each slab page. */
+struct slab {
+	unsigned magic;             /* Always set to SLAB_MAGIC. */
+	struct kmem_cache *cache;   /* Owning cache. */
+	struct list_elem elem;      /* In partial or full list. */
+	void *free;                 /* First free object, or null. */
+	size_t used_cnt;            /* Number of objects in use. */
+};
+
+/* All caches, most recently created first. */
+static struct kmem_cache *caches;
+
+/* Returns the free chain link of object OBJ of cache C. */
+#define FREE_LINK(C, OBJ) (*(void **) ((uint8_t *) (OBJ) + (C)->link_ofs))
+
+static struct slab *slab_create (struct kmem_cache *);
+static struct slab *obj_to_slab (void *);
+
+/* Creates and returns a cache of objects SIZE bytes long, named
+   NAME, whose constructor is CTOR, which may be null.  NAME must
+   remain valid for as long as the kernel runs.  Returns a null
+   pointer if memory is not available. */
+struct kmem_cache *
+kmem_cache_create (const char *name, size_t size, kmem_ctor_func *ctor,
+		void *aux) {
+	struct kmem_cache *c;
+	enum intr_level old_level;
+
+	ASSERT (name != NULL);
+	ASSERT (size > 0);
+
+	c = malloc (sizeof *c);
+	if (c == NULL)
+		return NULL;
+
+	c->name = name;
+	c->size = size;
+	c->obj_size = ROUND_UP (size, sizeof (void *));
+	c->link_ofs = ctor != NULL ? c->obj_size : 0;
+	if (ctor != NULL || c->obj_size < sizeof (void *))
+		c->obj_size += sizeof (void *);
+	c->objs_per_slab = (PGSIZE - sizeof (struct slab)) / c->obj_size;
+	ASSERT (c->objs_per_slab > 0);
+	c->ctor = ctor;
+	c->aux = aux;
+	lock_init (&c->lock);
+	list_init (&c->partial);
+	list_init (&c->full);
+	c->empty = NULL;
+	c->slab_cnt = c->used_cnt = 0;
+
+	old_level = intr_disable ();
+	c->next = caches;
+	caches = c;
+	intr_set_level (old_level);
+	return c;
+}
+
+/* Allocates and returns an object from cache C.  Returns a null
+   pointer if memory is not available. */
+void *
+kmem_cache_alloc (struct kmem_cache *c) {
+	struct slab *s;
+	void *obj;
+
+	lock_acquire (&c->lock);
+	if (!list_empty (&c->partial))
+		s = list_entry (list_front (&c->partial), struct slab, elem);
+	else {
+		if (c->empty != NULL) {
+			s = c->empty;
+			c->empty = NULL;
+		} else {
+			s = slab_create (c);
+			if (s == NULL) {
+				lock_release (&c->lock);
+				return NULL;
+			}
+		}
+		list_push_front (&c->partial, &s->elem);
+	}
+
+	obj = s->free;
+	s->free = FREE_LINK (c, obj);
+	s->used_cnt++;
+	c->used_cnt++;
+	if (s->free == NULL) {
+		list_remove (&s->elem);
+		list_push_front (&c->full, &s->elem);
+	}
+	lock_release (&c->lock);
+	return obj;
+}
+
+/* Frees OBJ, which must have been allocated from cache C. */
+void
+kmem_cache_free (struct kmem_cache *c, void *obj) {
+	struct slab *s;
+
+	if (obj == NULL)
+		return;
+
+	s = obj_to_slab (obj);
+	ASSERT (s->cache == c);
+
+#ifndef NDEBUG
+	if (c->ctor == NULL)
+		memset (obj, 0xcc, c->size);
+#endif
+
+	lock_acquire (&c->lock);
+	if (s->free == NULL) {
+		list_remove (&s->elem);
+		list_push_front (&c->partial, &s->elem);
+	}
+	FREE_LINK (c, obj) = s->free;
+	s->free = obj;
+	c->used_cnt--;
+	if (--s->used_cnt == 0) {
+		list_remove (&s->elem);
+		if (c->empty == NULL)
+			c->empty = s;
+		else {
+			s->magic = 0;
+			palloc_free_page (s);
+			c->slab_cnt--;
+		}
+	}
+	lock_release (&c->lock);
+}
+
+/* Returns the number of slab pages that cache C holds. */
+size_t
+kmem_cache_page_cnt (struct kmem_cache *c) {
+	return c->slab_cnt;
+}
+
+/* Prints the number of objects in use in each cache, and the
+   number of bytes of slab pages that do not hold them. */
+void
+kmem_print_stats (void) {
+	struct kmem_cache *c;
+
+	for (c = caches; c != NULL; c = c->next)
+		printf ("Cache %s: %zu objects of %zu bytes in use, "
+				"%zu slabs, %zu bytes overhead\n",
+				c->name, c->used_cnt, c->size, c->slab_cnt,
+				c->slab_cnt * PGSIZE - c->used_cnt * c->size);
+}
+
+/* Allocates a slab page for cache C and carves it into free
+   objects.  Returns a null pointer if memory is not available. */
+static struct slab *
+slab_create (struct kmem_cache *c) {
+	struct slab *s = palloc_get_page (0);
+	uint8_t *obj;
+	size_t i;
+
+	if (s == NULL)
+		return NULL;
+
+	s->magic = SLAB_MAGIC;
+	s->cache = c;
+	s->free = NULL;
+	s->used_cnt = 0;
+	obj = (uint8_t *) (s + 1) + c->objs_per_slab * c->obj_size;
+	for (i = 0; i < c->objs_per_slab; i++) {
+		obj -= c->obj_size;
+		if (c->ctor != NULL)
+			c->ctor (obj, c->aux);
+		FREE_LINK (c, obj) = s->free;
+		s->free = obj;
+	}
+	c->slab_cnt++;
+	return s;
+}
+
+/* Returns the slab that OBJ is inside. */
+static struct slab *
+obj_to_slab (void *obj) {
+	struct slab *s = pg_round_down (obj);
+
+	ASSERT (s->magic == SLAB_MAGIC);
+	ASSERT ((pg_ofs (obj) - sizeof *s) % s->cache->obj_size == 0);
+	return s;
+}
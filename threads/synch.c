@@ -31,6 +31,30 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
+
+/* One semaphore in a condition variable's wait queue. */
+struct semaphore_elem {
+	struct heap_elem elem;              /* Heap element. */
+	struct semaphore semaphore;         /* This semaphore. */
+	struct thread *thread;              /* Thread waiting on it. */
+	struct condition *cond;             /* Condition it waits for. */
+	uint64_t seq;                       /* Wait queue insertion order. */
+};
+
+/* Orders waiters that compare equal by the time they began to
+   wait, so that they are woken first-come, first-served. */
+static uint64_t wait_next_seq;
+
+static bool sema_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+static bool cond_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+#ifdef LOCKSTAT
+static void lockstat_acquired (struct lock *, bool contended,
+		uint64_t start);
+static void lockstat_released (struct lock *);
+#endif
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -46,7 +70,7 @@ sema_init (struct semaphore *sema, unsigned value) {
 	ASSERT (sema != NULL);
 
 	sema->value = value;
-	list_init (&sema->waiters);
+	heap_init (&sema->waiters, sema_less, NULL);
 }
 
 /* Down or "P" operation on a semaphore.  Waits for SEMA's value
@@ -66,8 +90,14 @@ sema_down (struct semaphore *sema) {
 
 	old_level = intr_disable ();
 	while (sema->value == 0) {
-		// list_push_back (&sema->waiters, &thread_current ()->elem);
-		list_insert_ordered (&sema->waiters, &thread_current ()->elem, compare_priority, 0);
+		struct thread *cur = thread_current ();
+
+		cur->wait_sema = sema;
+		cur->wait_seq = wait_next_seq++;
+		heap_insert (&sema->waiters, &cur->wait_elem);
+		mlfqs_wait_begin (cur);
+		if (cur->wait_on_lock != NULL)
+			donate_priority ();
 		thread_block ();
 	}
 	sema->value--;
@@ -99,6 +129,59 @@ sema_try_down (struct semaphore *sema) {
 	return success;
 }
 
+/* Returns true if waiting thread A should be woken before B,
+   whose waits began at SEQ_A and SEQ_B: it has an earlier
+   deadline, or a higher priority, or it has waited longer. */
+static bool
+waiter_less (const struct thread *a, uint64_t seq_a,
+		const struct thread *b, uint64_t seq_b) {
+	if (a->deadline != b->deadline)
+		return a->deadline < b->deadline;
+	if (a->priority != b->priority)
+		return a->priority > b->priority;
+	return seq_a < seq_b;
+}
+
+/* Orders a semaphore's waiting threads. */
+static bool
+sema_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, wait_elem);
+	const struct thread *b = heap_entry (b_, struct thread, wait_elem);
+
+	return waiter_less (a, a->wait_seq, b, b->wait_seq);
+}
+
+/* Orders a condition variable's waiters. */
+static bool
+cond_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct semaphore_elem *a = heap_entry (a_, struct semaphore_elem,
+			elem);
+	const struct semaphore_elem *b = heap_entry (b_, struct semaphore_elem,
+			elem);
+
+	return waiter_less (a->thread, a->seq, b->thread, b->seq);
+}
+
+/* Moves T within the wait queues it is in, after its priority or
+   deadline changed.  Interrupts must be off. */
+void
+synch_requeue (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->wait_sema != NULL) {
+		heap_remove (&t->wait_sema->waiters, &t->wait_elem);
+		heap_insert (&t->wait_sema->waiters, &t->wait_elem);
+	}
+	if (t->wait_cond != NULL) {
+		struct heap *waiters = &t->wait_cond->cond->waiters;
+
+		heap_remove (waiters, &t->wait_cond->elem);
+		heap_insert (waiters, &t->wait_cond->elem);
+	}
+}
+
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
    and wakes up one thread of those waiting for SEMA, if any.
 
@@ -110,10 +193,13 @@ sema_up (struct semaphore *sema) {
 	ASSERT (sema != NULL);
 
 	old_level = intr_disable ();
-	if (!list_empty (&sema->waiters)) {
-		list_sort (&sema->waiters, compare_priority, 0);
-		thread_unblock (list_entry (list_pop_front (&sema->waiters),
-					struct thread, elem));
+	if (!heap_empty (&sema->waiters)) {
+		struct thread *t = heap_entry (heap_pop_min (&sema->waiters),
+				struct thread, wait_elem);
+
+		t->wait_sema = NULL;
+		mlfqs_wait_end (t);
+		thread_unblock (t);
 	}
 	sema->value++;
 	preemption_priority ();
@@ -176,6 +262,9 @@ lock_init (struct lock *lock) {
 
 	lock->holder = NULL;
 	sema_init (&lock->semaphore, 1);
+#ifdef LOCKSTAT
+	memset (&lock->stat, 0, sizeof lock->stat);
+#endif
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -193,18 +282,26 @@ lock_acquire (struct lock *lock) {
 	ASSERT (!lock_held_by_current_thread (lock));
 
 	struct thread *cur = thread_current ();
-
-	if (lock->holder) {
-		cur->wait_on_lock = lock;
-		list_insert_ordered (&lock->holder->donations, &cur->donation_elem, compare_donation_priority, 0);
-
-		if (!thread_mlfqs)
-			donate_priority ();
-	}
-
+	enum intr_level old_level = intr_disable ();
+#ifdef LOCKSTAT
+	bool contended = lock->semaphore.value == 0;
+	uint64_t start = rdtsc ();
+#endif
+
+	/* If we have to wait, sema_down() donates to the holder once
+	   we are in the queue. */
+	cur->wait_on_lock = lock;
 	sema_down (&lock->semaphore);
 	cur->wait_on_lock = NULL;
-	lock->holder = thread_current ();
+	lock->holder = cur;
+	list_push_back (&cur->held_locks, &lock->elem);
+
+	/* The threads still waiting now donate to us. */
+	reset_priority ();
+	intr_set_level (old_level);
+#ifdef LOCKSTAT
+	lockstat_acquired (lock, contended, start);
+#endif
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -215,14 +312,22 @@ lock_acquire (struct lock *lock) {
    interrupt handler. */
 bool
 lock_try_acquire (struct lock *lock) {
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT (lock != NULL);
 	ASSERT (!lock_held_by_current_thread (lock));
 
+	old_level = intr_disable ();
 	success = sema_try_down (&lock->semaphore);
-	if (success)
+	if (success) {
 		lock->holder = thread_current ();
+		list_push_back (&lock->holder->held_locks, &lock->elem);
+#ifdef LOCKSTAT
+		lockstat_acquired (lock, false, 0);
+#endif
+	}
+	intr_set_level (old_level);
 	return success;
 }
 
@@ -234,18 +339,122 @@ lock_try_acquire (struct lock *lock) {
    handler. */
 void
 lock_release (struct lock *lock) {
+	enum intr_level old_level;
+
 	ASSERT (lock != NULL);
 	ASSERT (lock_held_by_current_thread (lock));
 
+#ifdef LOCKSTAT
+	lockstat_released (lock);
+#endif
+	old_level = intr_disable ();
 	lock->holder = NULL;
+	list_remove (&lock->elem);
+	reset_priority ();
+	intr_set_level (old_level);
+
+	sema_up (&lock->semaphore);
+}
+
+#ifdef LOCKSTAT
+/* Registered locks, most recently named first. */
+static struct lock_stat *named_locks;
+
+/* Names LOCK and registers it, so that lockstat_print() reports
+   it.  LOCK must stay in existence until shutdown, and NAME must
+   remain valid as long as LOCK.  In a kernel built without
+   LOCKSTAT this does nothing. */
+void
+lock_set_name (struct lock *lock, const char *name) {
+	enum intr_level old_level;
+
+	ASSERT (lock != NULL);
+	ASSERT (name != NULL);
+	ASSERT (lock->stat.name == NULL);
+
+	old_level = intr_disable ();
+	lock->stat.name = name;
+	lock->stat.next = named_locks;
+	named_locks = &lock->stat;
+	intr_set_level (old_level);
+}
 
-	if (!thread_mlfqs) {
-		remove_donations_lock (lock);
-		reset_priority ();
+/* Records that the current thread acquired LOCK, having waited
+   since START if CONTENDED.  The statistics are only ever updated
+   by the lock's holder, so the lock itself protects them. */
+static void
+lockstat_acquired (struct lock *lock, bool contended, uint64_t start) {
+	struct lock_stat *s = &lock->stat;
+	const char *name = thread_name ();
+	uint64_t now = rdtsc ();
+	int i, min = 0;
+
+	s->acquired++;
+	if (contended) {
+		uint64_t wait = now - start;
+
+		s->contended++;
+		s->wait_cycles += wait;
+		if (wait > s->max_wait_cycles)
+			s->max_wait_cycles = wait;
 	}
+	s->acquire_tsc = now;
+
+	/* Count the holder.  A holder not among the top ones replaces
+	   the least frequent, inheriting its count ("space saving"),
+	   so a frequent holder cannot be missed. */
+	for (i = 0; i < LOCKSTAT_HOLDERS; i++) {
+		if (!strcmp (s->holders[i].name, name)) {
+			s->holders[i].cnt++;
+			return;
+		}
+		if (s->holders[i].cnt < s->holders[min].cnt)
+			min = i;
+	}
+	strlcpy (s->holders[min].name, name, sizeof s->holders[min].name);
+	s->holders[min].cnt++;
+}
 
-	sema_up (&lock->semaphore);
+/* Records that the current thread is releasing LOCK. */
+static void
+lockstat_released (struct lock *lock) {
+	struct lock_stat *s = &lock->stat;
+	uint64_t hold = rdtsc () - s->acquire_tsc;
+
+	s->hold_cycles += hold;
+	if (hold > s->max_hold_cycles)
+		s->max_hold_cycles = hold;
+}
+
+/* Prints the statistics of every registered lock.  May be called
+   at any time, though the figures for a lock that is in use may
+   be slightly inconsistent. */
+void
+lockstat_print (void) {
+	struct lock_stat *s;
+
+	printf ("Locks (cycles): name, acquired, contended, avg/max wait, "
+			"avg/max hold, top holders\n");
+	for (s = named_locks; s != NULL; s = s->next) {
+		uint64_t acquired = s->acquired > 0 ? s->acquired : 1;
+		uint64_t contended = s->contended > 0 ? s->contended : 1;
+		int i;
+
+		printf ("%s: %llu, %llu, %llu/%llu, %llu/%llu,", s->name,
+				(unsigned long long) s->acquired,
+				(unsigned long long) s->contended,
+				(unsigned long long) (s->wait_cycles / contended),
+				(unsigned long long) s->max_wait_cycles,
+				(unsigned long long) (s->hold_cycles / acquired),
+				(unsigned long long) s->max_hold_cycles);
+		for (i = 0; i < LOCKSTAT_HOLDERS; i++)
+			if (s->holders[i].cnt > 0)
+				printf (" %s (%llu)", s->holders[i].name,
+						(unsigned long long) s->holders[i].cnt);
+		printf ("\n");
+	}
 }
+#endif /* LOCKSTAT */
 
 /* Returns true if the current thread holds LOCK, false
    otherwise.  (Note that testing whether some other thread holds
@@ -257,12 +466,6 @@ lock_held_by_current_thread (const struct lock *lock) {
 	return lock->holder == thread_current ();
 }
 
-/* One semaphore in a list. */
-struct semaphore_elem {
-	struct list_elem elem;              /* List element. */
-	struct semaphore semaphore;         /* This semaphore. */
-};
-
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -270,7 +473,7 @@ void
 cond_init (struct condition *cond) {
 	ASSERT (cond != NULL);
 
-	list_init (&cond->waiters);
+	heap_init (&cond->waiters, cond_less, NULL);
 }
 
 /* Atomically releases LOCK and waits for COND to be signaled by
@@ -296,6 +499,7 @@ cond_init (struct condition *cond) {
 void
 cond_wait (struct condition *cond, struct lock *lock) {
 	struct semaphore_elem waiter;
+	enum intr_level old_level;
 
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
@@ -303,8 +507,17 @@ cond_wait (struct condition *cond, struct lock *lock) {
 	ASSERT (lock_held_by_current_thread (lock));
 
 	sema_init (&waiter.semaphore, 0);
-	// list_push_back (&cond->waiters, &waiter.elem);
-	list_insert_ordered (&cond->waiters, &waiter.elem, sema_compare_priority, 0);
+	waiter.thread = thread_current ();
+	waiter.cond = cond;
+
+	/* Interrupts are off because synch_requeue() may move WAITER
+	   from an interrupt handler. */
+	old_level = intr_disable ();
+	waiter.seq = wait_next_seq++;
+	waiter.thread->wait_cond = &waiter;
+	heap_insert (&cond->waiters, &waiter.elem);
+	intr_set_level (old_level);
+
 	lock_release (lock);
 	sema_down (&waiter.semaphore);
 	lock_acquire (lock);
@@ -319,16 +532,24 @@ cond_wait (struct condition *cond, struct lock *lock) {
    interrupt handler. */
 void
 cond_signal (struct condition *cond, struct lock *lock UNUSED) {
+	struct semaphore_elem *w = NULL;
+	enum intr_level old_level;
+
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
 	ASSERT (!intr_context ());
 	ASSERT (lock_held_by_current_thread (lock));
 
-	if (!list_empty (&cond->waiters)) {
-		list_sort (&cond->waiters, sema_compare_priority, 0);
-		sema_up (&list_entry (list_pop_front (&cond->waiters),
-					struct semaphore_elem, elem)->semaphore);
+	old_level = intr_disable ();
+	if (!heap_empty (&cond->waiters)) {
+		w = heap_entry (heap_pop_min (&cond->waiters), struct semaphore_elem,
+				elem);
+		w->thread->wait_cond = NULL;
 	}
+	intr_set_level (old_level);
+
+	if (w != NULL)
+		sema_up (&w->semaphore);
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
@@ -342,16 +563,145 @@ cond_broadcast (struct condition *cond, struct lock *lock) {
 	ASSERT (cond != NULL);
 	ASSERT (lock != NULL);
 
-	while (!list_empty (&cond->waiters))
+	while (!heap_empty (&cond->waiters))
 		cond_signal (cond, lock);
 }
 
+/* Initializes RW.  A reader-writer lock admits any number of
+   readers at once, or a single writer.
+
+   It is fair: a writer that arrives while readers are inside
+   waits only for them to leave, and readers that arrive after it
+   queue behind it.  Entering threads queue on RW's inner lock,
+   which the writer holds until it is done, so a waiting thread
+   donates its priority to the writer.  Readers that are already
+   inside receive no donation.  Neither side is recursive: a
+   thread must not acquire RW again, even to read, while it holds
+   it. */
+void
+rwlock_init (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_init (&rw->lock);
+	rw->readers = 0;
+	rw->writer_waiting = false;
+	sema_init (&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.  This function may sleep, so it must not be
+   called within an interrupt handler. */
+void
+rwlock_read_acquire (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	rw->readers++;
+	lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread acquired for reading. */
+void
+rwlock_read_release (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	old_level = intr_disable ();
+	ASSERT (rw->readers > 0);
+	if (--rw->readers == 0 && rw->writer_waiting) {
+		rw->writer_waiting = false;
+		sema_up (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.  This function may sleep, so it must not be called within
+   an interrupt handler. */
+void
+rwlock_write_acquire (struct rwlock *rw) {
+	enum intr_level old_level;
+
+	ASSERT (rw != NULL);
+
+	lock_acquire (&rw->lock);
+	old_level = intr_disable ();
+	if (rw->readers > 0) {
+		rw->writer_waiting = true;
+		sema_down (&rw->drained);
+	}
+	intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread acquired for writing. */
+void
+rwlock_write_release (struct rwlock *rw) {
+	ASSERT (rw != NULL);
+	ASSERT (rw->readers == 0);
+
+	lock_release (&rw->lock);
+}
+
+/* Initializes SL.  A sequence lock suits a small record that is
+   read far more often than it is written, such as a counter that
+   an interrupt handler updates.  Readers take no lock: they copy
+   the record out between seqlock_read_begin() and
+   seqlock_read_retry(), and start over if a write overlapped
+   the copy.  Writers turn interrupts off for the write, which
+   must therefore be short and must not sleep.
+
+       unsigned seq;
+       do {
+           seq = seqlock_read_begin (&sl);
+           copy = record;
+       } while (seqlock_read_retry (&sl, seq)); */
+void
+seqlock_init (struct seqlock *sl) {
+	ASSERT (sl != NULL);
+
+	sl->seq = 0;
+}
+
+/* Begins a read of the record SL protects, and returns the value
+   to pass to seqlock_read_retry() after it. */
+unsigned
+seqlock_read_begin (const struct seqlock *sl) {
+	unsigned seq;
+
+	while ((seq = *(volatile const unsigned *) &sl->seq) & 1)
+		continue;
+	barrier ();
+	return seq;
+}
+
+/* Returns true if the read that seqlock_read_begin() began by
+   returning START overlapped a write, so the caller must read
+   the record again. */
 bool
-sema_compare_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-	struct semaphore_elem *sema_a = list_entry (a, struct semaphore_elem, elem);
-	struct semaphore_elem *sema_b = list_entry (b, struct semaphore_elem, elem);\
-	struct list *waiter_sema_a = list_begin (&(sema_a->semaphore.waiters));
-	struct list *watier_sema_b = list_begin (&(sema_b->semaphore.waiters));
+seqlock_read_retry (const struct seqlock *sl, unsigned start) {
+	barrier ();
+	return *(volatile const unsigned *) &sl->seq != start;
+}
+
+/* Begins a write of the record SL protects, turning interrupts
+   off until seqlock_write_end(). */
+void
+seqlock_write_begin (struct seqlock *sl) {
+	enum intr_level old_level = intr_disable ();
+
+	ASSERT (!(sl->seq & 1));
+	sl->seq++;
+	sl->old_level = old_level;
+	barrier ();
+}
+
+/* Ends a write begun with seqlock_write_begin(). */
+void
+seqlock_write_end (struct seqlock *sl) {
+	ASSERT (sl->seq & 1);
 
-	return compare_priority (waiter_sema_a, watier_sema_b, 0);
+	barrier ();
+	sl->seq++;
+	intr_set_level (sl->old_level);
 }
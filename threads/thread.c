@@ -9,6 +9,7 @@
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "intrinsic.h"
@@ -25,10 +26,68 @@
    Do not modify this value. */
 #define THREAD_BASIC 0xd42df210
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-static struct list sleep_list;
+/* Run queue of processes in THREAD_READY state, that is, processes
+   that are ready to run but not actually running.  There is one
+   FIFO list per priority level, and bit P of ready_bitmap is set
+   exactly when ready_list[P] is nonempty, so that finding the
+   highest-priority ready thread is a single bit scan. */
+#if PRI_MIN != 0 || PRI_MAX >= 64
+#error ready_bitmap requires PRI_MIN == 0 and PRI_MAX < 64
+#endif
+static struct list ready_list[PRI_MAX + 1];
+static uint64_t ready_bitmap;
+static size_t ready_cnt;        /* # of threads in ready_list. */
+
+/* Earliest-deadline-first class.
+
+   A thread that calls thread_set_edf() gets a budget of RUNTIME
+   ticks in each PERIOD, to be used within DEADLINE ticks of the
+   period's start.  Threads with a deadline in effect, their own
+   or one inherited through a lock, run ahead of all others,
+   earliest deadline first, from edf_ready_list.  A thread that
+   uses up its budget is throttled: it runs as an ordinary thread
+   until its next period begins.
+
+   Admission control keeps the sum of RUNTIME / DEADLINE over all
+   EDF threads within EDF_MAX_BANDWIDTH of one CPU. */
+#define EDF_BW_ONE (1 << 20)                    /* One whole CPU. */
+#define EDF_MAX_BANDWIDTH (EDF_BW_ONE / 100 * 95)
+static struct list edf_ready_list;
+static int64_t edf_bandwidth;           /* Admitted bandwidth. */
+
+/* Proportional-share scheduler ("-fair").
+
+   Each thread accrues virtual runtime at a rate inversely
+   proportional to its weight, which follows from its nice value,
+   and the ready thread with the least vruntime runs next.  In
+   this mode the run queue is fair_queue, a heap ordered by
+   (vruntime, fair_seq), in place of ready_list.
+
+   Every runnable thread runs once per scheduling period of
+   FAIR_LATENCY ticks, stretched to FAIR_MIN_SLICE per thread
+   when there are many, for a slice proportional to its share of
+   the total weight. */
+#define FAIR_LATENCY 8          /* Target scheduling period, in ticks. */
+#define FAIR_MIN_SLICE 1        /* Shortest slice, in ticks. */
+#define FAIR_VTICK 1024         /* vruntime per tick at nice 0. */
+static struct heap fair_queue;
+static int64_t fair_min_vruntime;       /* Never decreases. */
+static long fair_load;                  /* Sum of weights in fair_queue. */
+static uint64_t fair_next_seq;
+
+/* Weight for each nice value from -20 to 20.  Each step is worth
+   about 10% of CPU time relative to a competing thread. */
+static const int fair_weights[] = {
+	/* -20 */ 88761, 71755, 56483, 46273, 36291,
+	/* -15 */ 29154, 23254, 18705, 14949, 11916,
+	/* -10 */  9548,  7620,  6100,  4904,  3906,
+	/*  -5 */  3121,  2501,  1991,  1586,  1277,
+	/*   0 */  1024,   820,   655,   526,   423,
+	/*   5 */   335,   272,   215,   172,   137,
+	/*  10 */   110,    87,    70,    56,    45,
+	/*  15 */    36,    29,    23,    18,    15,
+	/*  20 */    12,
+};
 
 /* Idle thread. */
 static struct thread *idle_thread;
@@ -36,12 +95,22 @@ static struct thread *idle_thread;
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
-static struct lock tid_lock;
-
 /* Thread destruction requests */
 static struct list destruction_req;
 
+/* True while the idle thread catches up the ticks it skipped, on
+   its way to giving up the CPU (see idle_catch_up()).  Alarm
+   functions that run then must not try to preempt it. */
+static bool idle_catching_up;
+
+/* Pages of destroyed threads, kept for reuse by thread_create()
+   so that it skips the page allocator.  Interrupts must be off to
+   access the cache.  thread_cache_shrink() gives the pages back
+   when the kernel pool runs short. */
+#define THREAD_CACHE_MAX 16
+static void *thread_cache[THREAD_CACHE_MAX];
+static size_t thread_cache_cnt;
+
 /* Statistics. */
 static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
@@ -50,7 +119,6 @@ static long long user_ticks;    /* # of timer ticks in user programs. */
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
-static int64_t awake_tick;
 
 #define NICE_DEFAULT 0
 #define RECENT_CPU_DEFAULT 0
@@ -58,19 +126,109 @@ static int64_t awake_tick;
 static struct list all_list;
 int load_avg;
 
+/* Incremental MLFQS bookkeeping.
+
+   recent_cpu decays once per second, but only the running and
+   ready threads, and the threads on mlfqs_wait_list, which wait
+   in a semaphore, are decayed eagerly.  (A waiter's priority sets
+   its place in the wait queue, so it must stay current.)  Each
+   thread counts the decays applied to it in mlfqs_epoch; any
+   other blocked thread falls behind and catches up from
+   decay_history when it is next examined (see mlfqs_refresh()).
+   Threads that lag by half the history are caught up by an
+   occasional sweep.
+
+   Every 4 ticks, priorities are recomputed only for the threads
+   on mlfqs_dirty_list, whose recent_cpu or nice changed since the
+   previous pass.  The results are identical to recomputing every
+   thread. */
+#define DECAY_HISTORY 64                /* Power of 2. */
+static int decay_history[DECAY_HISTORY];/* Decay coefficient by epoch. */
+static int64_t mlfqs_epoch;             /* # of decays so far. */
+static int64_t mlfqs_pass_epoch;        /* mlfqs_epoch at last pass. */
+static struct list mlfqs_dirty_list;
+static struct list mlfqs_wait_list;
+
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, use the proportional-share scheduler.
+   Controlled by kernel command-line option "-fair". */
+bool thread_fair;
+
+/* Scheduler event trace.  Each event takes a slot in a ring of
+   TRACE_SIZE entries with a single atomic increment, so recording
+   needs no lock and is safe against interrupts: an interrupt that
+   records its own event just claims the next slot.  Once the ring
+   wraps, the oldest events are overwritten. */
+#define TRACE_SIZE 1024                 /* Power of 2. */
+
+enum trace_event {
+	TRACE_SWITCH_OUT,                   /* ARG: status left in. */
+	TRACE_SWITCH_IN,                    /* ARG: tid switched from. */
+	TRACE_BLOCK,
+	TRACE_UNBLOCK,                      /* ARG: tid of the waker. */
+	TRACE_WAKEUP,                       /* Timer wakeup; ARG unused. */
+	TRACE_DONATE,                       /* ARG: donated priority. */
+	TRACE_PRIORITY,                     /* ARG: new MLFQS priority. */
+};
+
+static const char *trace_names[] = {
+	"switch-out", "switch-in", "block", "unblock", "wakeup", "donate",
+	"priority",
+};
+
+struct trace_entry {
+	uint64_t tsc;                       /* Time stamp counter. */
+	int64_t tick;                       /* Timer ticks since boot. */
+	tid_t tid;                          /* Thread the event is about. */
+	int32_t arg;                        /* Event-specific. */
+	uint32_t event;                     /* enum trace_event. */
+};
+
+static struct trace_entry trace_ring[TRACE_SIZE];
+static uint64_t trace_head;             /* # of events ever recorded. */
+
+bool thread_trace;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
+static void thread_wake (struct alarm *);
 static void do_schedule(int status);
+static void idle_catch_up (void);
 static void schedule (void);
 static tid_t allocate_tid (void);
+static struct thread *thread_page_alloc (void);
+static void thread_page_free (struct thread *);
+static void ready_list_push (struct thread *);
+static void ready_list_remove (struct thread *);
+static struct thread *ready_list_pop (void);
+static int ready_list_max_priority (void);
+static void thread_update_priority (struct thread *, int priority);
+static void mlfqs_mark_dirty (struct thread *);
+static void mlfqs_decay (struct thread *, int64_t epoch);
+static int fair_weight (const struct thread *);
+static bool fair_less (const struct heap_elem *, const struct heap_elem *,
+		void *aux);
+static void fair_charge (struct thread *);
+static unsigned fair_slice (struct thread *);
+static bool fair_should_preempt (void);
+static int64_t edf_bw (int64_t runtime, int64_t deadline);
+static bool edf_less (const struct list_elem *, const struct list_elem *,
+		void *aux);
+static void edf_start_period (struct thread *);
+static void edf_replenish (struct alarm *);
+static int64_t edf_effective (struct thread *);
+static struct thread *lock_first_waiter (struct lock *);
+static int donated_priority (struct thread *);
+static void thread_refresh (struct thread *);
+static void thread_update_deadline (struct thread *, int64_t deadline);
+static void trace (enum trace_event, const struct thread *, int arg);
 
 /* Returns true if T appears to point to a valid thread. */
 #define is_thread(t) ((t) != NULL && (t)->magic == THREAD_MAGIC)
@@ -93,7 +251,7 @@ static uint64_t gdt[3] = { 0, 0x00af9a000000ffff, 0x00cf92000000ffff };
    general and it is possible in this case only because loader.S
    was careful to put the bottom of the stack at a page boundary.
 
-   Also initializes the run queue and the tid lock.
+   Also initializes the run queue.
 
    After calling this function, be sure to initialize the page
    allocator before trying to create any threads with
@@ -115,11 +273,14 @@ thread_init (void) {
 	lgdt (&gdt_ds);
 
 	/* Init the globla thread context */
-	lock_init (&tid_lock);
-	list_init (&ready_list);
+	for (int pri = PRI_MIN; pri <= PRI_MAX; pri++)
+		list_init (&ready_list[pri]);
+	heap_init (&fair_queue, fair_less, NULL);
+	list_init (&edf_ready_list);
 	list_init (&destruction_req);
-	list_init (&sleep_list);
 	list_init (&all_list);
+	list_init (&mlfqs_dirty_list);
+	list_init (&mlfqs_wait_list);
 
 	/* Set up a thread structure for the running thread. */
 	initial_thread = running_thread ();
@@ -138,6 +299,7 @@ thread_start (void) {
 	sema_init (&idle_started, 0);
 	thread_create ("idle", PRI_MIN, idle, &idle_started);
 	load_avg = LOAD_AVG_DEFAULT;
+	palloc_add_reclaim (0, thread_cache_shrink);
 
 	/* Start preemptive thread scheduling. */
 	intr_enable ();
@@ -162,11 +324,28 @@ thread_tick (void) {
 	else
 		kernel_ticks++;
 
+	if (thread_fair && t != idle_thread)
+		fair_charge (t);
+
+	if (t->edf_runtime > 0 && !t->edf_throttled && --t->edf_budget <= 0) {
+		/* Overran its budget: throttle until the next period. */
+		t->edf_throttled = true;
+		thread_refresh (t);
+		intr_yield_on_return ();
+	}
+
 	/* Enforce preemption. */
-	if (++thread_ticks >= TIME_SLICE)
+	if (++thread_ticks >= (thread_fair ? fair_slice (t) : TIME_SLICE))
 		intr_yield_on_return ();
 }
 
+/* Charges TICKS timer ticks that passed without a timer
+   interrupt, while the CPU was halted, to the idle thread. */
+void
+thread_idle_ticks (int64_t ticks) {
+	idle_ticks += ticks;
+}
+
 /* Prints thread statistics. */
 void
 thread_print_stats (void) {
@@ -174,6 +353,38 @@ thread_print_stats (void) {
 			idle_ticks, kernel_ticks, user_ticks);
 }
 
+/* Records EVENT about thread T in the trace ring, if tracing. */
+static inline void
+trace (enum trace_event event, const struct thread *t, int arg) {
+	struct trace_entry *e;
+
+	if (!thread_trace)
+		return;
+	e = &trace_ring[__atomic_fetch_add (&trace_head, 1, __ATOMIC_RELAXED)
+		& (TRACE_SIZE - 1)];
+	e->tsc = rdtsc ();
+	e->tick = timer_ticks ();
+	e->tid = t->tid;
+	e->arg = arg;
+	e->event = event;
+}
+
+/* Prints the trace ring, oldest event first, as CSV. */
+void
+thread_trace_dump (void) {
+	uint64_t head = trace_head;
+	uint64_t i = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+
+	printf ("seq,tsc,tick,event,tid,arg\n");
+	for (; i < head; i++) {
+		struct trace_entry *e = &trace_ring[i & (TRACE_SIZE - 1)];
+
+		printf ("%llu,%llu,%lld,%s,%d,%d\n", (unsigned long long) i,
+				(unsigned long long) e->tsc, (long long) e->tick,
+				trace_names[e->event], e->tid, e->arg);
+	}
+}
+
 /* Creates a new kernel thread named NAME with the given initial
    PRIORITY, which executes FUNCTION passing AUX as the argument,
    and adds it to the ready queue.  Returns the thread identifier
@@ -192,18 +403,24 @@ thread_print_stats (void) {
 tid_t
 thread_create (const char *name, int priority,
 		thread_func *function, void *aux) {
+	struct switch_frame *sf;
 	struct thread *t;
 	tid_t tid;
 
 	ASSERT (function != NULL);
 
 	/* Allocate thread. */
-	t = palloc_get_page (PAL_ZERO);
+	t = thread_page_alloc ();
 	if (t == NULL)
 		return TID_ERROR;
 
 	/* Initialize thread. */
 	init_thread (t, name, priority);
+	t->fdt = palloc_get_page (PAL_ZERO);
+	if (t->fdt == NULL) {
+		thread_page_free (t);
+		return TID_ERROR;
+	}
 	tid = t->tid = allocate_tid ();
 
 	/* Call the kernel_thread if it scheduled.
@@ -217,17 +434,28 @@ thread_create (const char *name, int priority,
 	t->tf.cs = SEL_KCSEG;
 	t->tf.eflags = FLAG_IF;
 
+	/* The first switch to the thread "returns" to switch_entry,
+	   which launches it from TF. */
+	sf = (struct switch_frame *) ((uint8_t *) t + PGSIZE) - 1;
+	memset (sf, 0, sizeof *sf);
+	sf->r12 = (uint64_t) &t->tf;
+	sf->rip = switch_entry;
+	t->ctx_rsp = (uint64_t) sf;
+
 	/* Add to run queue. */
 	list_push_back (&all_list, &t->all_elem);
+	if (thread_mlfqs)
+		mlfqs_mark_dirty (t);
+#ifdef USERPROG
+	/* Only process_wait() looks for children.  Elsewhere a dead
+	   child's page may be reused while still on the list. */
 	list_push_back (&thread_current ()->child_list, &t->child_elem);
+#endif
 
 	sema_init (&t->sema_exit, 0);
 	sema_init (&t->sema_fork, 0);
 	sema_init (&t->sema_wait, 0);
 	
-	t->fdt = palloc_get_page (PAL_ZERO);
-	if (t->fdt == NULL)
-		return TID_ERROR;
 	t->fdt[0] = 1;
 	t->fdt[1] = 2;
 	t->next_fd = 2;
@@ -248,7 +476,9 @@ void
 thread_block (void) {
 	ASSERT (!intr_context ());
 	ASSERT (intr_get_level () == INTR_OFF);
+	idle_catch_up ();
 	thread_current ()->status = THREAD_BLOCKED;
+	trace (TRACE_BLOCK, thread_current (), 0);
 	schedule ();
 }
 
@@ -268,9 +498,20 @@ thread_unblock (struct thread *t) {
 
 	old_level = intr_disable ();
 	ASSERT (t->status == THREAD_BLOCKED);
-	// list_push_back (&ready_list, &t->elem);
-	list_insert_ordered (&ready_list, &t->elem, compare_priority, 0);
+	if (thread_mlfqs)
+		mlfqs_refresh (t);
+	if (thread_fair) {
+		/* Credit a thread that slept with at most half a period,
+		   so that it cannot monopolize the CPU on waking. */
+		int64_t floor = fair_min_vruntime - FAIR_LATENCY * FAIR_VTICK / 2;
+
+		if (t->vruntime < floor)
+			t->vruntime = floor;
+	}
+	ready_list_push (t);
 	t->status = THREAD_READY;
+	if (thread_trace)
+		trace (TRACE_UNBLOCK, t, running_thread ()->tid);
 	intr_set_level (old_level);
 }
 
@@ -312,12 +553,23 @@ thread_exit (void) {
 
 #ifdef USERPROG
 	process_exit ();
+#else
+	palloc_free_page (thread_current ()->fdt);
 #endif
+	malloc_drain ();
 
 	/* Just set our status to dying and schedule another process.
 	   We will be destroyed during the call to schedule_tail(). */
 	intr_disable ();
+	if (thread_current ()->edf_runtime > 0) {
+		struct thread *cur = thread_current ();
+
+		edf_bandwidth -= edf_bw (cur->edf_runtime, cur->edf_deadline);
+		alarm_cancel (&cur->edf_alarm);
+	}
 	list_remove (&thread_current ()->all_elem);
+	if (thread_current ()->mlfqs_dirty)
+		list_remove (&thread_current ()->mlfqs_elem);
 	do_schedule (THREAD_DYING);
 	NOT_REACHED ();
 }
@@ -333,8 +585,7 @@ thread_yield (void) {
 
 	old_level = intr_disable ();
 	if (curr != idle_thread)
-		// list_push_back (&ready_list, &curr->elem);
-		list_insert_ordered (&ready_list, &curr->elem, compare_priority, 0);
+		ready_list_push (curr);
 	do_schedule (THREAD_READY);
 	intr_set_level (old_level);
 }
@@ -356,6 +607,47 @@ thread_get_priority (void) {
 	return thread_current ()->priority;
 }
 
+/* Puts the running thread in the EDF class, with a budget of
+   RUNTIME ticks in every PERIOD ticks to be spent within
+   DEADLINE ticks of each period's start, replacing any earlier
+   parameters.  All-zero arguments return it to the ordinary
+   classes.  Returns false, leaving the thread as it was, unless
+   0 < RUNTIME <= DEADLINE <= PERIOD and there is bandwidth to
+   admit it. */
+bool
+thread_set_edf (int64_t runtime, int64_t deadline, int64_t period) {
+	struct thread *cur = thread_current ();
+	bool leave = runtime == 0 && deadline == 0 && period == 0;
+	int64_t old_bw, new_bw;
+	enum intr_level old_level;
+
+	if (!leave && !(0 < runtime && runtime <= deadline && deadline <= period))
+		return false;
+
+	old_level = intr_disable ();
+	old_bw = cur->edf_runtime > 0 ? edf_bw (cur->edf_runtime, cur->edf_deadline) : 0;
+	new_bw = leave ? 0 : edf_bw (runtime, deadline);
+	if (edf_bandwidth - old_bw + new_bw > EDF_MAX_BANDWIDTH) {
+		intr_set_level (old_level);
+		return false;
+	}
+	edf_bandwidth += new_bw - old_bw;
+
+	cur->edf_runtime = runtime;
+	cur->edf_deadline = deadline;
+	cur->edf_period = period;
+	if (leave) {
+		cur->edf_throttled = false;
+		alarm_cancel (&cur->edf_alarm);
+	} else
+		edf_start_period (cur);
+	thread_refresh (cur);
+	preemption_priority ();
+	intr_set_level (old_level);
+
+	return true;
+}
+
 /* Sets the current thread's nice value to NICE. */
 void
 thread_set_nice (int nice UNUSED) {
@@ -431,6 +723,17 @@ idle (void *idle_started_ UNUSED) {
 		intr_disable ();
 		thread_block ();
 
+		/* Zero free pages for later PAL_ZERO allocations.  With
+		   interrupts on, a thread that becomes ready meanwhile
+		   preempts us. */
+		intr_enable ();
+		palloc_zero_idle ();
+		intr_disable ();
+
+		/* In tickless mode, stop the periodic tick until the
+		   next tick that has work to do. */
+		timer_idle_enter ();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -473,11 +776,16 @@ init_thread (struct thread *t, const char *name, int priority) {
 	t->priority = priority;
 	t->magic = THREAD_MAGIC;
 	t->init_priority = priority;
+	alarm_init (&t->sleep_alarm, thread_wake, t);
 	t->wait_on_lock = NULL;
-	list_init (&t->donations);
+	list_init (&t->held_locks);
 	list_init (&t->child_list);
 	t->nice = NICE_DEFAULT;
 	t->recent_cpu = RECENT_CPU_DEFAULT;
+	t->mlfqs_epoch = mlfqs_epoch;
+	t->vruntime = fair_min_vruntime;
+	t->deadline = EDF_NONE;
+	alarm_init (&t->edf_alarm, edf_replenish, t);
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
@@ -487,10 +795,310 @@ init_thread (struct thread *t, const char *name, int priority) {
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) {
-	if (list_empty (&ready_list))
+	if (ready_cnt == 0)
 		return idle_thread;
 	else
-		return list_entry (list_pop_front (&ready_list), struct thread, elem);
+		return ready_list_pop ();
+}
+
+/* Appends T to the tail of the run queue for its priority.
+   Interrupts must be off. */
+static void
+ready_list_push (struct thread *t) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->deadline != EDF_NONE)
+		list_insert_ordered (&edf_ready_list, &t->elem, edf_less, NULL);
+	else if (thread_fair) {
+		t->fair_seq = fair_next_seq++;
+		heap_insert (&fair_queue, &t->fair_elem);
+		fair_load += fair_weight (t);
+	} else {
+		list_push_back (&ready_list[t->priority], &t->elem);
+		ready_bitmap |= 1ULL << t->priority;
+	}
+	ready_cnt++;
+}
+
+/* Removes T from the run queue it is in.
+   Interrupts must be off. */
+static void
+ready_list_remove (struct thread *t) {
+
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->deadline != EDF_NONE)
+		list_remove (&t->elem);
+	else if (thread_fair) {
+		heap_remove (&fair_queue, &t->fair_elem);
+		fair_load -= fair_weight (t);
+	} else {
+		list_remove (&t->elem);
+		if (list_empty (&ready_list[t->priority]))
+			ready_bitmap &= ~(1ULL << t->priority);
+	}
+	ready_cnt--;
+}
+
+/* Removes and returns the ready thread with the earliest
+   deadline, or failing that the thread at the head of the
+   highest-priority nonempty run queue, or in -fair mode the
+   thread with the least vruntime.  The run queue must not be
+   empty. */
+static struct thread *
+ready_list_pop (void) {
+	struct thread *t;
+
+	ASSERT (ready_cnt > 0);
+	if (!list_empty (&edf_ready_list))
+		t = list_entry (list_front (&edf_ready_list), struct thread, elem);
+	else if (thread_fair)
+		t = heap_entry (heap_min (&fair_queue), struct thread, fair_elem);
+	else
+		t = list_entry (list_front (&ready_list[ready_list_max_priority ()]),
+				struct thread, elem);
+	ready_list_remove (t);
+	return t;
+}
+
+/* Returns the highest priority of any ready thread, or
+   PRI_MIN - 1 if no thread is ready. */
+static int
+ready_list_max_priority (void) {
+	if (ready_bitmap == 0)
+		return PRI_MIN - 1;
+	return 63 - __builtin_clzll (ready_bitmap);
+}
+
+/* Changes T's priority to PRIORITY.  If T is ready, it is moved
+   to the tail of the run queue for its new priority.  (The -fair
+   run queue does not depend on priority.)  If T is waiting in a
+   semaphore or condition variable, it is moved in that queue. */
+static void
+thread_update_priority (struct thread *t, int priority) {
+	enum intr_level old_level;
+
+	ASSERT (PRI_MIN <= priority && priority <= PRI_MAX);
+
+	old_level = intr_disable ();
+	if (t->priority != priority) {
+		if (t->status == THREAD_READY && !thread_fair) {
+			ready_list_remove (t);
+			t->priority = priority;
+			ready_list_push (t);
+		} else
+			t->priority = priority;
+		synch_requeue (t);
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns T's -fair weight. */
+static int
+fair_weight (const struct thread *t) {
+	int nice = t->nice;
+
+	if (nice < -20)
+		nice = -20;
+	else if (nice > 20)
+		nice = 20;
+	return fair_weights[nice + 20];
+}
+
+/* Returns true if thread A should run before thread B in -fair
+   mode: A has less vruntime, or as much but was queued earlier. */
+static bool
+fair_less (const struct heap_elem *a_, const struct heap_elem *b_,
+		void *aux UNUSED) {
+	const struct thread *a = heap_entry (a_, struct thread, fair_elem);
+	const struct thread *b = heap_entry (b_, struct thread, fair_elem);
+
+	if (a->vruntime != b->vruntime)
+		return a->vruntime < b->vruntime;
+	return a->fair_seq < b->fair_seq;
+}
+
+/* Charges a tick of CPU time to T, the running thread, and
+   advances fair_min_vruntime. */
+static void
+fair_charge (struct thread *t) {
+	int64_t min;
+
+	t->vruntime += (int64_t) FAIR_VTICK * fair_weights[20] / fair_weight (t);
+
+	min = t->vruntime;
+	if (!heap_empty (&fair_queue)) {
+		struct thread *first = heap_entry (heap_min (&fair_queue),
+				struct thread, fair_elem);
+		if (first->vruntime < min)
+			min = first->vruntime;
+	}
+	if (min > fair_min_vruntime)
+		fair_min_vruntime = min;
+}
+
+/* Returns the length of T's slice in ticks: its share, by
+   weight, of one scheduling period. */
+static unsigned
+fair_slice (struct thread *t) {
+	long weight = fair_weight (t);
+	long load = fair_load + weight;
+	int64_t period = FAIR_LATENCY;
+	int64_t slice;
+
+	if ((int64_t) (ready_cnt + 1) * FAIR_MIN_SLICE > period)
+		period = (ready_cnt + 1) * FAIR_MIN_SLICE;
+
+	slice = period * weight / load;
+	return slice < FAIR_MIN_SLICE ? FAIR_MIN_SLICE : slice;
+}
+
+/* Returns true if the running thread is at least a tick's worth
+   of vruntime ahead of the first ready thread. */
+static bool
+fair_should_preempt (void) {
+	struct thread *curr = thread_current ();
+	struct thread *first;
+
+	if (heap_empty (&fair_queue))
+		return false;
+	if (curr == idle_thread)
+		return true;
+
+	first = heap_entry (heap_min (&fair_queue), struct thread, fair_elem);
+	return first->vruntime + FAIR_VTICK < curr->vruntime;
+}
+
+/* Returns the share of the CPU, in units of EDF_BW_ONE, used by
+   RUNTIME ticks in every DEADLINE. */
+static int64_t
+edf_bw (int64_t runtime, int64_t deadline) {
+	return runtime * EDF_BW_ONE / deadline;
+}
+
+/* Returns true if thread A's deadline is earlier than B's. */
+static bool
+edf_less (const struct list_elem *a, const struct list_elem *b,
+		void *aux UNUSED) {
+	return list_entry (a, struct thread, elem)->deadline
+		< list_entry (b, struct thread, elem)->deadline;
+}
+
+/* Starts a new EDF period for T, now, with a full budget. */
+static void
+edf_start_period (struct thread *t) {
+	int64_t now = timer_ticks ();
+
+	t->edf_budget = t->edf_runtime;
+	t->edf_job_deadline = now + t->edf_deadline;
+	t->edf_throttled = false;
+	alarm_arm (&t->edf_alarm, now + t->edf_period);
+}
+
+/* Alarm function that starts the next EDF period of thread A's
+   AUX. */
+static void
+edf_replenish (struct alarm *a) {
+	struct thread *t = a->aux;
+
+	edf_start_period (t);
+	thread_refresh (t);
+	preemption_priority ();
+}
+
+/* Returns the thread first in line for LOCK, or a null pointer
+   if no thread waits for it. */
+static struct thread *
+lock_first_waiter (struct lock *lock) {
+	struct heap *waiters = &lock->semaphore.waiters;
+
+	if (heap_empty (waiters))
+		return NULL;
+	return heap_entry (heap_min (waiters), struct thread, wait_elem);
+}
+
+/* Returns the deadline T should run under: the earliest of its
+   own, unless it is throttled, and those of the threads first in
+   line for the locks it holds.  A lock's waiters are ordered by
+   deadline first, so its first waiter has the earliest. */
+static int64_t
+edf_effective (struct thread *t) {
+	int64_t deadline = EDF_NONE;
+	struct list_elem *e;
+
+	if (t->edf_runtime > 0 && !t->edf_throttled)
+		deadline = t->edf_job_deadline;
+
+	for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+			e = list_next (e)) {
+		struct thread *w = lock_first_waiter (list_entry (e, struct lock, elem));
+
+		if (w != NULL && w->deadline < deadline)
+			deadline = w->deadline;
+	}
+	return deadline;
+}
+
+/* Returns the priority T should run at: the highest of its own
+   and those of the threads first in line for the locks it holds.
+   (If a lock's first waiter has a deadline, a waiter behind it
+   may have a higher priority, but T then inherits the deadline,
+   which outranks any priority.) */
+static int
+donated_priority (struct thread *t) {
+	int priority = t->init_priority;
+	struct list_elem *e;
+
+	for (e = list_begin (&t->held_locks); e != list_end (&t->held_locks);
+			e = list_next (e)) {
+		struct thread *w = lock_first_waiter (list_entry (e, struct lock, elem));
+
+		if (w != NULL && w->priority > priority)
+			priority = w->priority;
+	}
+	return priority;
+}
+
+/* Recomputes the deadline and, except under -mlfqs, the priority
+   in effect for T, then for the holder of the lock T waits on, and
+   so on up the chain for as long as they change.  Each step looks
+   only at the first waiters of the locks one thread holds, so a
+   change costs O(locks held) per step, however many threads wait. */
+static void
+thread_refresh (struct thread *t) {
+	enum intr_level old_level = intr_disable ();
+
+	for (int depth = 0; t != NULL && depth < 8; depth++) {
+		int64_t deadline = edf_effective (t);
+		int priority = thread_mlfqs ? t->priority : donated_priority (t);
+
+		if (deadline == t->deadline && priority == t->priority)
+			break;
+		if (priority > t->priority)
+			trace (TRACE_DONATE, t, priority);
+		thread_update_deadline (t, deadline);
+		thread_update_priority (t, priority);
+		if (t->wait_on_lock == NULL)
+			break;
+		t = t->wait_on_lock->holder;
+	}
+	intr_set_level (old_level);
+}
+
+/* Changes T's deadline in effect to DEADLINE, moving T between
+   run queues if it is ready, or within its wait queues.
+   Interrupts must be off. */
+static void
+thread_update_deadline (struct thread *t, int64_t deadline) {
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->status == THREAD_READY) {
+		ready_list_remove (t);
+		t->deadline = deadline;
+		ready_list_push (t);
+	} else
+		t->deadline = deadline;
+	synch_requeue (t);
 }
 
 /* Use iretq to launch the thread */
@@ -533,61 +1141,12 @@ do_iret (struct intr_frame *tf) {
    added at the end of the function. */
 static void
 thread_launch (struct thread *th) {
-	uint64_t tf_cur = (uint64_t) &running_thread ()->tf;
-	uint64_t tf = (uint64_t) &th->tf;
 	ASSERT (intr_get_level () == INTR_OFF);
 
-	/* The main switching logic.
-	 * We first restore the whole execution context into the intr_frame
-	 * and then switching to the next thread by calling do_iret.
-	 * Note that, we SHOULD NOT use any stack from here
-	 * until switching is done. */
-	__asm __volatile (
-			/* Store registers that will be used. */
-			"push %%rax\n"
-			"push %%rbx\n"
-			"push %%rcx\n"
-			/* Fetch input once */
-			"movq %0, %%rax\n"
-			"movq %1, %%rcx\n"
-			"movq %%r15, 0(%%rax)\n"
-			"movq %%r14, 8(%%rax)\n"
-			"movq %%r13, 16(%%rax)\n"
-			"movq %%r12, 24(%%rax)\n"
-			"movq %%r11, 32(%%rax)\n"
-			"movq %%r10, 40(%%rax)\n"
-			"movq %%r9, 48(%%rax)\n"
-			"movq %%r8, 56(%%rax)\n"
-			"movq %%rsi, 64(%%rax)\n"
-			"movq %%rdi, 72(%%rax)\n"
-			"movq %%rbp, 80(%%rax)\n"
-			"movq %%rdx, 88(%%rax)\n"
-			"pop %%rbx\n"              // Saved rcx
-			"movq %%rbx, 96(%%rax)\n"
-			"pop %%rbx\n"              // Saved rbx
-			"movq %%rbx, 104(%%rax)\n"
-			"pop %%rbx\n"              // Saved rax
-			"movq %%rbx, 112(%%rax)\n"
-			"addq $120, %%rax\n"
-			"movw %%es, (%%rax)\n"
-			"movw %%ds, 8(%%rax)\n"
-			"addq $32, %%rax\n"
-			"call __next\n"         // read the current rip.
-			"__next:\n"
-			"pop %%rbx\n"
-			"addq $(out_iret -  __next), %%rbx\n"
-			"movq %%rbx, 0(%%rax)\n" // rip
-			"movw %%cs, 8(%%rax)\n"  // cs
-			"pushfq\n"
-			"popq %%rbx\n"
-			"mov %%rbx, 16(%%rax)\n" // eflags
-			"mov %%rsp, 24(%%rax)\n" // rsp
-			"movw %%ss, 32(%%rax)\n"
-			"mov %%rcx, %%rdi\n"
-			"call do_iret\n"
-			"out_iret:\n"
-			: : "g"(tf_cur), "g" (tf) : "memory"
-			);
+	/* Only the callee-saved registers need saving: see switch.S.
+	   A new thread's first switch goes through switch_entry and
+	   do_iret() instead. */
+	switch_context (&running_thread ()->ctx_rsp, th->ctx_rsp);
 }
 
 /* Schedules a new process. At entry, interrupts must be off.
@@ -598,15 +1157,29 @@ static void
 do_schedule(int status) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (thread_current()->status == THREAD_RUNNING);
+	idle_catch_up ();
 	while (!list_empty (&destruction_req)) {
 		struct thread *victim =
 			list_entry (list_pop_front (&destruction_req), struct thread, elem);
-		palloc_free_page(victim);
+		thread_page_free (victim);
 	}
 	thread_current ()->status = status;
 	schedule ();
 }
 
+/* If the running thread is the idle thread, catches up the ticks
+   it skipped while halted, firing the alarms that came due.  Runs
+   before the idle thread gives up the CPU, so that the threads
+   those alarms wake are candidates to run next. */
+static void
+idle_catch_up (void) {
+	if (running_thread () != idle_thread)
+		return;
+	idle_catching_up = true;
+	timer_idle_exit ();
+	idle_catching_up = false;
+}
+
 static void
 schedule (void) {
 	struct thread *curr = running_thread ();
@@ -615,6 +1188,7 @@ schedule (void) {
 	ASSERT (intr_get_level () == INTR_OFF);
 	ASSERT (curr->status != THREAD_RUNNING);
 	ASSERT (is_thread (next));
+
 	/* Mark us as running. */
 	next->status = THREAD_RUNNING;
 
@@ -639,6 +1213,9 @@ schedule (void) {
 			list_push_back (&destruction_req, &curr->elem);
 		}
 
+		trace (TRACE_SWITCH_OUT, curr, curr->status);
+		trace (TRACE_SWITCH_IN, next, curr->tid);
+
 		/* Before switching the thread, we first save the information
 		 * of current running. */
 		thread_launch (next);
@@ -649,133 +1226,277 @@ schedule (void) {
 static tid_t
 allocate_tid (void) {
 	static tid_t next_tid = 1;
-	tid_t tid;
 
-	lock_acquire (&tid_lock);
-	tid = next_tid++;
-	lock_release (&tid_lock);
+	return __atomic_fetch_add (&next_tid, 1, __ATOMIC_RELAXED);
+}
 
-	return tid;
+/* Returns a page for a new thread, from the thread cache if it
+   has one, or a null pointer if memory is exhausted.  The page is
+   not zeroed: init_thread() clears the struct thread, and the
+   rest of the page is stack. */
+static struct thread *
+thread_page_alloc (void) {
+	struct thread *t = NULL;
+	enum intr_level old_level;
+
+	old_level = intr_disable ();
+	if (thread_cache_cnt > 0)
+		t = thread_cache[--thread_cache_cnt];
+	intr_set_level (old_level);
+
+	if (t == NULL)
+		t = palloc_get_page (0);
+	return t;
 }
 
-int64_t
-get_awake_tick (void) {
-	return awake_tick;
+/* Puts the page of T, which is no longer running, in the thread
+   cache, or frees it if the cache is full. */
+static void
+thread_page_free (struct thread *t) {
+	enum intr_level old_level;
+
+	t->magic = 0;
+
+	old_level = intr_disable ();
+	if (thread_cache_cnt < THREAD_CACHE_MAX) {
+		thread_cache[thread_cache_cnt++] = t;
+		t = NULL;
+	}
+	intr_set_level (old_level);
+
+	if (t != NULL)
+		palloc_free_page (t);
 }
 
-void
-next_awake_tick (int64_t ticks) {
-	awake_tick = (awake_tick > ticks) ? ticks : awake_tick;
+/* Frees up to PAGE_CNT pages from the thread cache.  Returns the
+   number of pages freed.  The kernel pool's reclaim hook. */
+size_t
+thread_cache_shrink (size_t page_cnt) {
+	void *pages[THREAD_CACHE_MAX];
+	enum intr_level old_level;
+	size_t cnt;
+
+	old_level = intr_disable ();
+	cnt = thread_cache_cnt < page_cnt ? thread_cache_cnt : page_cnt;
+	thread_cache_cnt -= cnt;
+	memcpy (pages, thread_cache + thread_cache_cnt, cnt * sizeof *pages);
+	intr_set_level (old_level);
+
+	for (size_t i = 0; i < cnt; i++)
+		palloc_free_page (pages[i]);
+	return cnt;
 }
 
+/* Blocks the running thread until timer tick TICKS.  The thread
+   is woken by its sleep alarm from the timer interrupt. */
 void
 thread_sleep (int64_t ticks) {
 	struct thread *cur = thread_current ();
-	enum intr_level old_level = intr_disable ();
-	
-	if (cur != idle_thread) {
-		next_awake_tick (cur->wakeup_tick = ticks);
-		list_push_back (&sleep_list, &cur->elem);
-		thread_block ();
-		intr_set_level (old_level);
-	}
-}
+	enum intr_level old_level;
 
-void
-thread_awake (int64_t wakeup_tick) {
-	awake_tick = INT64_MAX;
-	struct list_elem *e = list_begin (&sleep_list);
-
-	while (e != list_end (&sleep_list)) {
-		struct thread *t = list_entry (e, struct thread, elem);
-
-		if (wakeup_tick >= t->wakeup_tick) {
-			e = list_remove (&t->elem);
-			thread_unblock (t);
-		} else {
-			e = list_next (e);
-			next_awake_tick (t->wakeup_tick);
-		}
-	}
+	if (cur == idle_thread)
+		return;
+
+	old_level = intr_disable ();
+	alarm_arm (&cur->sleep_alarm, ticks);
+	thread_block ();
+	intr_set_level (old_level);
 }
 
-bool
-compare_priority (struct list_elem *a, struct list_elem *b, void *aux UNUSED) {
-	return list_entry (a, struct thread, elem)->priority > list_entry (b, struct thread, elem)->priority;
+/* Alarm function that ends the thread_sleep() of the thread in
+   A's AUX. */
+static void
+thread_wake (struct alarm *a) {
+	trace (TRACE_WAKEUP, a->aux, 0);
+	thread_unblock (a->aux);
 }
 
+/* Yields the CPU if a ready thread has an earlier deadline than
+   the running one, or neither has a deadline and the ready thread
+   has a higher priority or, in -fair mode, is owed the CPU.  In
+   an interrupt handler the yield is deferred until the handler
+   returns.  Does nothing while the idle thread catches up skipped
+   ticks, since the scheduler is about to choose a thread anyway. */
 void
 preemption_priority (void) {
-	if (!list_empty (&ready_list) && thread_current ()->priority < list_entry (list_front (&ready_list), struct thread, elem)->priority)
-		thread_yield ();
-}
+	struct thread *curr;
+	bool preempt;
 
-bool
-compare_donation_priority (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
-	return list_entry (a, struct thread, donation_elem)->priority > list_entry (b, struct thread, donation_elem)->priority;
-}
+	if (idle_catching_up)
+		return;
 
-void
-donate_priority (void) {
-	int depth;
-	struct thread *cur = thread_current ();
+	curr = thread_current ();
+	if (!list_empty (&edf_ready_list)
+			&& list_entry (list_front (&edf_ready_list), struct thread,
+				elem)->deadline < curr->deadline)
+		preempt = true;
+	else if (curr->deadline != EDF_NONE)
+		preempt = false;
+	else if (thread_fair)
+		preempt = fair_should_preempt ();
+	else
+		preempt = curr->priority < ready_list_max_priority ();
 
-	for (depth = 0; depth < 8; depth++) {
-		if (cur->wait_on_lock == NULL) {
-			break;
-		} else {
-			struct thread *holder = cur->wait_on_lock->holder;
-			holder->priority = cur->priority;
-			cur = holder;
-		}
+	if (preempt) {
+		if (intr_context ())
+			intr_yield_on_return ();
+		else
+			thread_yield ();
 	}
 }
 
+/* Passes the running thread's priority and deadline, which it
+   has just queued for the lock it waits on, to the holder of that
+   lock, and on up the chain.  Deadlines are inherited under every
+   scheduler, priorities except under -mlfqs. */
 void
-remove_donations_lock (struct lock *lock) {
-	struct list_elem *e;
-	struct thread *cur = thread_current ();
-
-	for (e = list_begin (&cur->donations); e != list_end (&cur->donations); e = list_next (e)) {
-		struct thread *t = list_entry (e, struct thread, donation_elem);
+donate_priority (void) {
+	struct lock *lock = thread_current ()->wait_on_lock;
 
-		if (t->wait_on_lock == lock)
-			list_remove (&t->donation_elem);
-	}
+	if (lock != NULL)
+		thread_refresh (lock->holder);
 }
 
+/* Recomputes the running thread's priority and deadline, after
+   it set its own or acquired or released a lock. */
 void
 reset_priority (void) {
-	struct thread *cur = thread_current ();
-
-	cur->priority = cur->init_priority;
-
-	if (!list_empty (&cur->donations)) {
-		// list_sort (&cur->donations, compare_donation_priority, 0);
-		struct thread *front = list_entry (list_front (&cur->donations), struct thread, donation_elem);
-
-		if (front->priority > cur->priority)
-			cur->priority = front->priority;
-	}
+	thread_refresh (thread_current ());
 }
 
 void mlfqs_increase_recent_cpu (void) {
     if (thread_current () != idle_thread) {
         int cur_recent_cpu = thread_current ()->recent_cpu;
         thread_current ()->recent_cpu = add_mixed (cur_recent_cpu, 1);
+        mlfqs_mark_dirty (thread_current ());
     }
 }
 
+/* Applies one second's recent_cpu decay.  The running and ready
+   threads and the semaphore waiters are decayed now; other
+   blocked threads catch up lazily. */
 void mlfqs_recalc_recent_cpu (void) {
-    for (struct list_elem *e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e)) {
-        mlfqs_update_recent_cpu (list_entry (e, struct thread, all_elem));
+    int a = mult_mixed (load_avg, 2);
+    int b = add_mixed (a, 1);
+
+    mlfqs_epoch++;
+    decay_history[mlfqs_epoch % DECAY_HISTORY] = div_fp (a, b);
+
+    mlfqs_update_recent_cpu (thread_current ());
+    for (uint64_t map = ready_bitmap; map != 0; map &= map - 1) {
+        struct list *queue = &ready_list[__builtin_ctzll (map)];
+
+        for (struct list_elem *e = list_begin (queue); e != list_end (queue); e = list_next (e))
+            mlfqs_update_recent_cpu (list_entry (e, struct thread, elem));
+    }
+    for (struct list_elem *e = list_begin (&edf_ready_list); e != list_end (&edf_ready_list); e = list_next (e))
+        mlfqs_update_recent_cpu (list_entry (e, struct thread, elem));
+    for (struct list_elem *e = list_begin (&mlfqs_wait_list); e != list_end (&mlfqs_wait_list); e = list_next (e))
+        mlfqs_update_recent_cpu (list_entry (e, struct thread, mlfqs_wait_elem));
+
+    /* Keep blocked threads within reach of decay_history. */
+    if (mlfqs_epoch % (DECAY_HISTORY / 2) == 0) {
+        for (struct list_elem *e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e)) {
+            struct thread *t = list_entry (e, struct thread, all_elem);
+
+            if (t->status == THREAD_BLOCKED)
+                mlfqs_refresh (t);
+        }
     }
 }
 
+/* Returns true if thread A's tid is less than thread B's. */
+static bool
+tid_less (const struct list_elem *a, const struct list_elem *b, void *aux UNUSED) {
+    return list_entry (a, struct thread, mlfqs_elem)->tid
+        < list_entry (b, struct thread, mlfqs_elem)->tid;
+}
+
+/* Recomputes the priority of every thread whose recent_cpu or
+   nice changed since the last pass, in creation order. */
 void mlfqs_recalc_priority (void) {
-    for (struct list_elem *e = list_begin (&all_list); e != list_end (&all_list); e = list_next (e)) {
-        mlfqs_update_priority (list_entry (e, struct thread, all_elem));
+    list_sort (&mlfqs_dirty_list, tid_less, NULL);
+    while (!list_empty (&mlfqs_dirty_list)) {
+        struct thread *t = list_entry (list_pop_front (&mlfqs_dirty_list), struct thread, mlfqs_elem);
+
+        t->mlfqs_dirty = false;
+        mlfqs_update_priority (t);
+    }
+    mlfqs_pass_epoch = mlfqs_epoch;
+}
+
+/* Returns true if the next priority pass has any work to do.
+   Passes that have none may be skipped while idle. */
+bool mlfqs_pass_pending (void) {
+    return !list_empty (&mlfqs_dirty_list) || mlfqs_pass_epoch != mlfqs_epoch;
+}
+
+/* Queues T for the next priority pass. */
+static void
+mlfqs_mark_dirty (struct thread *t) {
+    if (!t->mlfqs_dirty) {
+        t->mlfqs_dirty = true;
+        list_push_back (&mlfqs_dirty_list, &t->mlfqs_elem);
+    }
+}
+
+/* Applies to T, in order, the decays it has missed up to EPOCH. */
+static void
+mlfqs_decay (struct thread *t, int64_t epoch) {
+    ASSERT (epoch - t->mlfqs_epoch <= DECAY_HISTORY);
+
+    while (t->mlfqs_epoch < epoch) {
+        int c = decay_history[++t->mlfqs_epoch % DECAY_HISTORY];
+        int new_recent_cpu = add_mixed (mult_fp (c, t->recent_cpu), t->nice);
+
+        if ((new_recent_cpu >> 31) == (-1) >> 31)
+            new_recent_cpu = 0;
+
+        t->recent_cpu = new_recent_cpu;
+    }
+}
+
+/* Brings the recent_cpu and priority of T, which may have been
+   blocked across one or more decays, to the values a full
+   recalculation of every thread would have given it. */
+void mlfqs_refresh (struct thread *t) {
+    enum intr_level old_level;
+
+    if (t == idle_thread)
+        return;
+
+    old_level = intr_disable ();
+    if (t->mlfqs_epoch < mlfqs_pass_epoch) {
+        /* The last pass saw the decays before it. */
+        mlfqs_decay (t, mlfqs_pass_epoch);
+        mlfqs_update_priority (t);
     }
+    if (t->mlfqs_epoch < mlfqs_epoch) {
+        /* The pass at the latest decay's tick ran before it. */
+        mlfqs_decay (t, mlfqs_epoch);
+        mlfqs_mark_dirty (t);
+    }
+    intr_set_level (old_level);
+}
+
+/* Called by sema_down() when T, which is up to date, starts
+   waiting in a semaphore, so that it keeps being decayed: the
+   priority pass then moves it within its wait queue, through
+   synch_requeue().  Interrupts must be off. */
+void mlfqs_wait_begin (struct thread *t) {
+    ASSERT (intr_get_level () == INTR_OFF);
+
+    if (thread_mlfqs)
+        list_push_back (&mlfqs_wait_list, &t->mlfqs_wait_elem);
+}
+
+/* Called by sema_up() when T stops waiting in a semaphore.
+   Interrupts must be off. */
+void mlfqs_wait_end (struct thread *t) {
+    ASSERT (intr_get_level () == INTR_OFF);
+
+    if (thread_mlfqs)
+        list_remove (&t->mlfqs_wait_elem);
 }
 
 void mlfqs_update_priority (struct thread *t)
@@ -792,29 +1513,26 @@ void mlfqs_update_priority (struct thread *t)
         if (new_priority > PRI_MAX)
             new_priority = PRI_MAX;
 
-        t->priority = new_priority;
+        if (new_priority != t->priority)
+            trace (TRACE_PRIORITY, t, new_priority);
+        thread_update_priority (t, new_priority);
     }
 }
 
+/* Applies to T any decays it has not seen yet and queues it for
+   the next priority pass. */
 void mlfqs_update_recent_cpu (struct thread *t)
 {
-    if (t != idle_thread) {
-        int a = mult_mixed (load_avg, 2);
-        int b = add_mixed (a, 1);
-        int c = div_fp (a, b);
-        int d = mult_fp (c, t->recent_cpu);
-        int new_recent_cpu = add_mixed (d, t->nice);
-
-        if ((new_recent_cpu >> 31) == (-1) >> 31)
-            new_recent_cpu = 0;
-
-        t->recent_cpu = new_recent_cpu;
+    if (t != idle_thread && t->mlfqs_epoch < mlfqs_epoch) {
+        mlfqs_decay (t, mlfqs_epoch);
+        mlfqs_mark_dirty (t);
     }
 }
 
 void mlfqs_update_load_avg (void)
 {
-	int ready_thread = (int) list_size (&ready_list);
+	int ready_thread = (int) ready_cnt;
+
 	ready_thread = (thread_current () == idle_thread) ? ready_thread : ready_thread + 1;
 
     int a = div_fp (int_to_fp (59), int_to_fp (60));
@@ -27,6 +27,17 @@ static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
 static void __do_fork (void *);
 
+bool process_large_pages;
+
+/* Pages that fork shared with the child, and pages it copied.
+ * Pages that a write to a shared page then copied, and pages it
+ * found no longer shared and made writable in place. */
+static long long fork_shared, fork_copied;
+static long long cow_copied, cow_reused;
+
+/* 2 MB user pages mapped with -large-pages. */
+static long long large_mapped;
+
 /* General process initializer for initd and other process. */
 static void
 process_init (void) {
@@ -93,8 +104,46 @@ process_fork (const char *name, struct intr_frame *if_ UNUSED) {
 }
 
 #ifndef VM
+/* Duplicates the parent's 2 MB page at VA, mapped by PTE, into the
+ * running child.  Falls back to small pages if no 2 MB of free
+ * memory is aligned for a large page. */
+static bool
+duplicate_large_pte (uint64_t *pte, void *va, struct thread *parent) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	uint8_t *parent_page = pml4_get_page (parent->pml4, va);
+	bool writable = is_writable (pte);
+	void *newpage = palloc_get_large (PAL_USER);
+	size_t i;
+
+	if (newpage != NULL) {
+		memcpy (newpage, parent_page, LARGE_PGSIZE);
+		if (pml4_set_large_page (pml4, va, newpage, writable))
+			return true;
+		palloc_free_multiple (newpage, LARGE_PGCNT);
+		return false;
+	}
+
+	for (i = 0; i < LARGE_PGCNT; i++) {
+		newpage = palloc_get_page (PAL_USER);
+		if (newpage == NULL)
+			return false;
+		memcpy (newpage, parent_page + i * PGSIZE, PGSIZE);
+		if (!pml4_set_page (pml4, (uint8_t *) va + i * PGSIZE, newpage,
+					writable)) {
+			palloc_free_page (newpage);
+			return false;
+		}
+	}
+	return true;
+}
+
 /* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
+ * pml4_for_each. This is only for the project 2.
+ * Pages are shared rather than copied.  A writable page becomes
+ * read-only with PTE_COW set in both processes, until a write to
+ * it calls process_cow_fault().  The parent is switched out while
+ * this runs, so it reloads its page tables, and drops the old
+ * writable mappings from the TLB, before it runs again. */
 static bool
 duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	struct thread *current = thread_current ();
@@ -107,12 +156,31 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	if (is_kernel_vaddr (va))
 		return true;
 
+	if (is_large_pte (pte))
+		return duplicate_large_pte (pte, va, parent);
+
 	/* 2. Resolve VA from the parent's page map level 4. */
 	parent_page = pml4_get_page (parent->pml4, va);
 
 	if (parent_page == NULL)
 		return false;
 
+	writable = is_writable (pte) || (*pte & PTE_COW);
+	if (palloc_share_page (parent_page)) {
+		if (writable)
+			*pte = (*pte & ~PTE_W) | PTE_COW;
+		if (!pml4_set_page (current->pml4, va, parent_page, false)) {
+			palloc_free_page (parent_page);
+			return false;
+		}
+		if (writable)
+			*pml4e_walk (current->pml4, (uint64_t) va, 0) |= PTE_COW;
+		fork_shared++;
+		return true;
+	}
+
+	/* The page has too many sharers already, so copy it. */
+
 	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
 	 *    TODO: NEWPAGE. */
 	newpage = palloc_get_page(PAL_USER);
@@ -124,18 +192,97 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 	 *    TODO: check whether parent's page is writable or not (set WRITABLE
 	 *    TODO: according to the result). */
 	memcpy (newpage, parent_page, PGSIZE);
-	writable = is_writable (pte);
+	fork_copied++;
 
 	/* 5. Add new page to child's page table at address VA with WRITABLE
 	 *    permission. */
 	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
 		/* 6. TODO: if fail to insert page, do error handling. */
+		palloc_free_page (newpage);
 		return false;
 	}
 	return true;
 }
 #endif
 
+/* Returns the PTE that maps UPAGE in the running process if it is
+ * a copy-on-write page, otherwise a null pointer. */
+static uint64_t *
+cow_pte (void *upage) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	uint64_t *pte;
+
+	if (pml4 == NULL || !is_user_vaddr (upage))
+		return NULL;
+	pte = pml4e_walk (pml4, (uint64_t) upage, 0);
+	if (pte == NULL || !(*pte & PTE_P) || !(*pte & PTE_COW))
+		return NULL;
+	return pte;
+}
+
+/* Makes the copy-on-write page UPAGE, mapped by PTE, writable.
+ * Copies the page if other processes still share it, into the
+ * user pool's emergency reserve if need be.  Returns false if
+ * memory ran out. */
+static bool
+cow_break (uint64_t *pte, void *upage) {
+	void *kpage = ptov (PTE_ADDR (*pte));
+
+	if (palloc_page_shared (kpage)) {
+		void *newpage = palloc_get_page (PAL_USER | PAL_RESERVE);
+
+		if (newpage == NULL)
+			return false;
+		memcpy (newpage, kpage, PGSIZE);
+		*pte = vtop (newpage) | (*pte & PTE_FLAGS & ~PTE_COW) | PTE_W;
+		palloc_free_page (kpage);
+		cow_copied++;
+	} else {
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		cow_reused++;
+	}
+	invlpg ((uint64_t) upage);
+	return true;
+}
+
+/* Handles a write fault at ADDR in the running process.  Returns
+ * true if ADDR is on a copy-on-write page, which is now writable,
+ * or false if the fault is some other fault. */
+bool
+process_cow_fault (void *addr) {
+	void *upage = pg_round_down (addr);
+	uint64_t *pte = cow_pte (upage);
+
+	return pte != NULL && cow_break (pte, upage);
+}
+
+/* Makes the copy-on-write pages among the SIZE bytes at BUFFER in
+ * the running process writable, ahead of a write to them by the
+ * kernel, which does not fault on read-only user pages.  Returns
+ * false if memory ran out. */
+bool
+process_cow_unshare (void *buffer, size_t size) {
+	uint8_t *upage = pg_round_down (buffer);
+	uint8_t *end = (uint8_t *) buffer + size;
+
+	for (; upage < end && is_user_vaddr (upage); upage += PGSIZE) {
+		uint64_t *pte = cow_pte (upage);
+
+		if (pte != NULL && !cow_break (pte, upage))
+			return false;
+	}
+	return true;
+}
+
+/* Prints fork statistics. */
+void
+process_print_stats (void) {
+	printf ("Fork: %lld pages shared, %lld copied; "
+			"%lld copied on write, %lld reused on write\n",
+			fork_shared, fork_copied, cow_copied, cow_reused);
+	printf ("Large pages: %lld mapped\n", large_mapped);
+}
+
 /* A thread function that copies parent's execution context.
  * Hint) parent->tf does not hold the userland context of the process.
  *       That is, you are required to pass second argument of process_fork to
@@ -549,6 +696,7 @@ validate_segment (const struct Phdr *phdr, struct file *file) {
 
 /* load() helpers. */
 static bool install_page (void *upage, void *kpage, bool writable);
+static bool install_large_page (void *upage);
 
 /* Loads a segment starting at offset OFS in FILE at address
  * UPAGE.  In total, READ_BYTES + ZERO_BYTES bytes of virtual
@@ -579,6 +727,17 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
 		size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
+		/* With -large-pages, map each aligned 2 MB of zeroes with
+		 * a single large page, if one is available. */
+		if (process_large_pages && read_bytes == 0 && writable
+				&& zero_bytes >= LARGE_PGSIZE
+				&& ((uint64_t) upage & (LARGE_PGSIZE - 1)) == 0
+				&& install_large_page (upage)) {
+			zero_bytes -= LARGE_PGSIZE;
+			upage += LARGE_PGSIZE;
+			continue;
+		}
+
 		/* Get a page of memory. */
 		uint8_t *kpage = palloc_get_page (PAL_USER);
 		if (kpage == NULL)
@@ -641,6 +800,25 @@ install_page (void *upage, void *kpage, bool writable) {
 	return (pml4_get_page (t->pml4, upage) == NULL
 			&& pml4_set_page (t->pml4, upage, kpage, writable));
 }
+
+/* Maps 2 MB of zeroed, writable memory at user virtual address
+ * UPAGE, which must be aligned on 2 MB, with a large page.
+ * Returns true on success, false if no 2 MB of free memory is
+ * aligned for it or if any of the 2 MB is already mapped. */
+static bool
+install_large_page (void *upage) {
+	struct thread *t = thread_current ();
+	void *kpage = palloc_get_large (PAL_USER | PAL_ZERO);
+
+	if (kpage == NULL)
+		return false;
+	if (!pml4_set_large_page (t->pml4, upage, kpage, true)) {
+		palloc_free_multiple (kpage, LARGE_PGCNT);
+		return false;
+	}
+	large_mapped++;
+	return true;
+}
 #else
 /* From here, codes will be used after project 3.
  * If you want to implement the function for only project 2, implement it on the
@@ -8,6 +8,7 @@
 #include "threads/thread.h"
 #include "threads/loader.h"
 #include "userprog/gdt.h"
+#include "userprog/process.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
 
@@ -30,6 +31,7 @@ void syscall_handler (struct intr_frame *);
 void
 syscall_init (void) {
 	lock_init (&filesys_lock);
+	lock_set_name (&filesys_lock, "filesys");
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
 			((uint64_t)SEL_KCSEG) << 32);
 	write_msr(MSR_LSTAR, (uint64_t) syscall_entry);
@@ -191,6 +193,10 @@ int read (int fd, void *buffer, unsigned size) {
 	struct file *file = thread_current ()->fdt[fd];
 
 	if (file) {
+		/* The kernel writes BUFFER without faulting on pages
+		   shared copy-on-write, so copy them first. */
+		if (!process_cow_unshare (buffer, size))
+			exit (-1);
 		lock_acquire (&filesys_lock);
 		int read_byte = file_read (file, buffer, size);
 		lock_release (&filesys_lock);